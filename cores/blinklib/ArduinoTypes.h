@@ -15,8 +15,10 @@
 	#include <stdint.h>
     typedef bool boolean;
     typedef uint8_t byte;
-    typedef unsigned int word;
+    typedef uint16_t word;          // Same as unsigned int on AVR, but still 16 bits on a PC
 
-    typedef uint32_t ulong;
+    #ifdef __AVR__
+    typedef uint32_t ulong;         // Host C libraries already have their own (see tools/hostsim)
+    #endif
 
 #endif
\ No newline at end of file
@@ -199,7 +199,7 @@ size_t Print::printNumber(unsigned long n, uint8_t base)
     n /= base;
 
     *--str = c < 10 ? c + '0' : c + 'A' - 10;
-  } while(n);
+  } while(n);         // WCET: 32 (one digit per bit in base 2)
 
   return write(str);
 }
@@ -247,4 +247,67 @@ size_t Print::printFloat(double number, uint8_t digits)
   }
 
   return n;
-}
\ No newline at end of file
+}
+
+// Print a fixed point number given its raw value and how many of the low bits are fraction.
+// Same output as printFloat() but all integer math.
+
+// A binary fraction with up to this many bits has at most this many decimal digits,
+// so any digits past this are always 0 for fix8_8 and fix16_16.
+
+#define FIXED_MAX_DIGITS 16
+
+size_t Print::printFixed(long raw, uint8_t fracBits, uint8_t digits)
+{
+  size_t n = 0;
+
+  unsigned long number = raw;
+
+  // Handle negative numbers
+  if (raw < 0)
+  {
+     n += print('-');
+     number = -number;
+  }
+
+  unsigned long fracMask = (1UL << fracBits) - 1;
+  unsigned long whole = number >> fracBits;
+  unsigned long remainder = number & fracMask;
+
+  // Work out the digits before printing any, so we can round at the last one
+  uint8_t fracDigits[FIXED_MAX_DIGITS];
+  uint8_t count = digits < FIXED_MAX_DIGITS ? digits : FIXED_MAX_DIGITS;
+
+  for (uint8_t i=0; i<count; ++i)        // WCET: 16 (FIXED_MAX_DIGITS)
+  {
+    remainder *= 10;
+    fracDigits[i] = remainder >> fracBits;
+    remainder &= fracMask;
+  }
+
+  // Round correctly so that print(1.999, 2) prints as "2.00"
+  if (remainder * 2 > fracMask)
+  {
+    uint8_t i = count;
+
+    while (i > 0 && fracDigits[i-1] == 9)      // WCET: 16 (FIXED_MAX_DIGITS)
+      fracDigits[--i] = 0;
+
+    if (i > 0)
+      fracDigits[i-1]++;
+    else
+      whole++;
+  }
+
+  n += print(whole);
+
+  // Print the decimal point, but only if there are digits beyond
+  if (digits > 0) {
+    n += print('.');
+  }
+
+  for (uint8_t i=0; i<digits; ++i)
+    n += print((char)('0' + (i < count ? fracDigits[i] : 0)));
+
+  return n;
+}
@@ -50,11 +50,16 @@ class __FlashStringHelper;
 #endif
 #define BIN 2
 
+// Fixed point numbers from fixed.h. Just a declaration so we can print them without pulling the whole thing in here.
+
+template< typename T , typename W , uint8_t F > class Fixed;
+
 class Print
 {
   private:
     size_t printNumber(unsigned long, uint8_t);
     size_t printFloat(double, uint8_t);
+    size_t printFixed(long, uint8_t, uint8_t);
   public:
     virtual size_t write(uint8_t) = 0;
     size_t write(const char *str) {
@@ -79,6 +84,13 @@ class Print
     size_t print(unsigned long, int = DEC);
     size_t print(double, int = 2);
 
+    // Prints a fixed point number with the same default 2 decimal places as a double, but without any float code
+
+    template< typename T , typename W , uint8_t F >
+    size_t print(const Fixed<T,W,F> &x, int digits = 2) {
+      return printFixed(x.raw, F, digits);
+    }
+
     size_t println(const __FlashStringHelper *);
     size_t println(const char[]);
     size_t println(char);
@@ -88,6 +100,13 @@ class Print
     size_t println(long, int = DEC);
     size_t println(unsigned long, int = DEC);
     size_t println(double, int = 2);
+
+    template< typename T , typename W , uint8_t F >
+    size_t println(const Fixed<T,W,F> &x, int digits = 2) {
+      size_t n = print(x, digits);
+      n += println();
+      return n;
+    }
     size_t println(void);
 
     virtual void flush() { /* Empty implementation for backward compatibility */ }
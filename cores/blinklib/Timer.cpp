@@ -1,11 +1,11 @@
-#include <limits.h>         // Get ULONG_MAX for NEVER
+#include <stdint.h>         // Get UINT32_MAX for NEVER
 
 #include "blinklib.h"
 // Note we directly access millis() here, which is really bad style.
 // The timer should capture millis() in a closure, but no good way to
 // do that in C++ that is not verbose and inefficient, so here we are.
 
-#define NEVER (ULONG_MAX)
+#define NEVER (UINT32_MAX)     // Same as ULONG_MAX on a tile, but m_expireTime is 32 bits on a PC too
 
 // All Timers come into this world pre-expired, so their expireTime is 0
 // Here we leave the constructor empty and depend in the BBS section clearing
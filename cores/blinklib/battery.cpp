@@ -0,0 +1,166 @@
+/*
+ * battery.cpp
+ *
+ * Background battery voltage monitoring.
+ *
+ * We measure the supply voltage by using the ADC to read the internal 1.1V bandgap reference
+ * against AVcc. The lower the battery, the bigger the bandgap looks in comparison, so...
+ *
+ *      Vcc = 1.1V * 1024 / ADC
+ *
+ * We never block waiting on the ADC. Instead we step a tiny state machine once per pass though the main loop -
+ * turn on the ADC and let the bandgap settle, start a conversion, then on a later pass pick up the result
+ * and turn the ADC back off to save power. This only happens once every BATTERY_SAMPLE_INTERVAL_MS,
+ * so the rest of the time the per-pass cost is just a compare.
+ *
+ */
+
+#include <avr/io.h>
+
+#include "blinklib.h"
+
+#include "hooks.h"
+
+#define BATTERY_SAMPLE_INTERVAL_MS  1000        // How often we take a reading
+
+#define BATTERY_SETTLE_MS              2        // How long to let the bandgap reference settle after switching the ADC mux to it
+
+#define BATTERY_BANDGAP_MV          1100        // Nominal bandgap voltage. Datasheet says this can be anywhere from 1.0V to 1.2V, so absolute readings are +/-10%
+
+#define BATTERY_FILTER_SHIFT           2        // Each new reading moves the filtered value 1/4 of the way
+
+#define BATTERY_LOW_MV              2500        // Battery is considered low below this...
+#define BATTERY_OK_MV               2600        // ...and only becomes ok again above this so a noisy reading can not make it flicker.
+
+// ADMUX setting to read the bandgap against AVcc
+// REFS0=AVcc with external cap at AREF, MUX3:0=1110 for the 1.1V bandgap
+
+#define BATTERY_ADMUX   ( _BV(REFS0) | _BV(MUX3) | _BV(MUX2) | _BV(MUX1) )
+
+// Prescaler /64 gets us a 125KHz ADC clock at 8Mhz, right in the 50-200KHz sweet spot for full resolution
+
+#define BATTERY_ADCSRA  ( _BV(ADEN) | _BV(ADPS2) | _BV(ADPS1) )
+
+#define BATTERY_STATE_IDLE          0       // Waiting for the next sample time
+#define BATTERY_STATE_SETTLING      1       // ADC on and pointed at the bandgap, waiting for it to settle
+#define BATTERY_STATE_CONVERTING    2       // Conversion started, waiting for it to complete
+
+static uint8_t batteryState;
+
+static unsigned long batteryNextStepTime;   // When the state machine should next do something
+
+static uint16_t batteryFilteredMV;          // 0 until we get our first reading
+
+static uint8_t batteryLowFlag;              // 1 if the battery is currently low
+static uint8_t batteryLowEventFlag;         // Set when the battery becomes low, cleared when read
+
+static uint8_t batterySavedPRR;             // So we can put the ADC power reduction bit back the way we found it
+
+void battery_loop_hook() {
+
+    if ( batteryNextStepTime > millis() ) {
+        return;
+    }
+
+    switch (batteryState) {
+
+        case BATTERY_STATE_IDLE:
+
+            // Power up the ADC and point it at the bandgap
+
+            batterySavedPRR = PRR;
+            PRR &= ~_BV(PRADC);
+
+            ADMUX  = BATTERY_ADMUX;
+            ADCSRA = BATTERY_ADCSRA;
+
+            batteryNextStepTime = millis() + BATTERY_SETTLE_MS;
+            batteryState = BATTERY_STATE_SETTLING;
+
+            break;
+
+        case BATTERY_STATE_SETTLING:
+
+            ADCSRA = BATTERY_ADCSRA | _BV(ADSC);        // Start conversion
+
+            batteryState = BATTERY_STATE_CONVERTING;
+
+            break;
+
+        case BATTERY_STATE_CONVERTING:
+
+            if ( ADCSRA & _BV(ADSC) ) {
+
+                // Still converting, check back next pass
+
+                return;
+            }
+
+            uint16_t adc = ADC;
+
+            // Done with the ADC, so power it back down
+
+            ADCSRA = 0;
+            PRR = batterySavedPRR;
+
+            if (adc) {          // Paranoia - do not divide by zero
+
+                uint16_t mv = ( (uint32_t) BATTERY_BANDGAP_MV * 1024 ) / adc;
+
+                if ( batteryFilteredMV == 0 ) {
+
+                    // First reading, nothing to filter against yet
+
+                    batteryFilteredMV = mv;
+
+                } else {
+
+                    batteryFilteredMV += ( (int16_t) ( mv - batteryFilteredMV ) ) >> BATTERY_FILTER_SHIFT;
+
+                }
+
+                if ( batteryFilteredMV < BATTERY_LOW_MV ) {
+
+                    if (!batteryLowFlag) {
+
+                        batteryLowFlag = 1;
+                        batteryLowEventFlag = 1;
+
+                    }
+
+                } else if ( batteryFilteredMV > BATTERY_OK_MV ) {
+
+                    batteryLowFlag = 0;
+
+                }
+
+            }
+
+            batteryNextStepTime = millis() + BATTERY_SAMPLE_INTERVAL_MS;
+            batteryState = BATTERY_STATE_IDLE;
+
+            break;
+
+    }
+
+}
+
+word getBatteryMillivolts() {
+
+    return batteryFilteredMV;
+
+}
+
+bool isBatteryLow() {
+
+    return batteryLowFlag;
+
+}
+
+bool batteryLowDetected() {
+
+    bool r = batteryLowEventFlag;
+    batteryLowEventFlag = 0;
+    return r;
+
+}
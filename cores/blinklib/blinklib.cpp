@@ -46,6 +46,8 @@
 
 #include "shared/blinkbios_shared_functions.h"     // Gets us ir_send_packet()
 
+#include "hooks.h"          // Hook points for optional services
+
 
 #define TX_PROBE_TIME_MS           150     // How often to do a blind send when no RX has happened recently to trigger ping pong
                                            // Nice to have probe time shorter than expire time so you have to miss 2 messages
@@ -53,6 +55,14 @@
 
 #define RX_EXPIRE_TIME_MS         200      // If we do not see a message in this long, then show that face as expired
 
+#define LINK_QUALITY_SAMPLE_MS     50      // How often we fold the good packets seen on each face into its link quality average
+
+#define LINK_QUALITY_EWMA_SHIFT     2      // Each sample moves the link quality 1/4 of the way towards the new sample
+#define LINK_QUALITY_SAMPLE_GOOD   ( 248 >> LINK_QUALITY_EWMA_SHIFT )     // Added for a sample with a good packet, so a perfect link settles at 248
+
+#define LINK_QUALITY_STABLE_ABOVE 192      // Link quality must get above this for a face to become stably connected...
+#define LINK_QUALITY_STABLE_BELOW  64      // ...and must fall below this to become unstable again. The gap is our hysteresis.
+
 #define VIRAL_BUTTON_PRESS_LOCKOUT_MS   2000    // Any viral button presses received from IR within this time period are ignored 
                                                 // since insures that a single press can not circulate around indefinitely.                                                
 
@@ -79,6 +89,13 @@
 
 #define NOP_SPECIAL_VALUE   0b00110011
 
+// This is a special byte that signals a service packet. Service packets carry traffic for the optional
+// built in services (like neighbor discovery) so they do not need to use up the sketch's datagrams.
+// Packet is header byte, service ID byte, payload, then an inverted checksum of the ID and payload.
+// They are always at least 3 bytes long so we can tell them apart from values and the 2 byte special packets.
+
+#define SERVICE_SPECIAL_VALUE   0b00100101
+
 
 // We use bit 6 in the IR data to indicate that a button has been pressed so we should 
 // postpone sleeping. This spreads a button press to all connected tiles so 
@@ -94,39 +111,70 @@
 #endif
 
 // Returns true if odd number of bits set
-// TODO: make asm
+// Constant time. We fold the byte onto itself with XORs so the parity of all 8 bits ends up in bit 0.
+// The swap instruction gets us the first fold for 1 cycle. 11 cycles total, no branches.
+
+static inline uint8_t oddParity( uint8_t d ) {
+
+#ifdef __AVR__
+
+    asm (
+        "mov __tmp_reg__ , %0   \n\t"
+        "swap __tmp_reg__       \n\t"       // Fold top nibble onto bottom
+        "eor %0 , __tmp_reg__   \n\t"
+        "mov __tmp_reg__ , %0   \n\t"
+        "lsr __tmp_reg__        \n\t"       // Fold bits 2-3 onto bits 0-1
+        "lsr __tmp_reg__        \n\t"
+        "eor %0 , __tmp_reg__   \n\t"
+        "mov __tmp_reg__ , %0   \n\t"
+        "lsr __tmp_reg__        \n\t"       // Fold bit 1 onto bit 0
+        "eor %0 , __tmp_reg__   \n\t"
+        "andi %0 , 0x01         \n\t"
+        : "+d" (d)
+    );
+
+    return d;
+
+#else
+
+    // Same folds in plain C for host builds (see tools/hostsim)
+
+    d ^= d >> 4;
+    d ^= d >> 2;
+    d ^= d >> 1;
+
+    return d & 0x01;
+
+#endif
 
-uint8_t oddParity( uint8_t d ) {
-    
-    uint8_t bits=0;
-    
-    while (d) {
-        
-        if (d & 0b00000001 ) {
-            bits++;
-        }
-        
-        d >>=1;
-        
-    }
-    
-    return bits & 0xb00000001;
 }
 
+// Precomputed encoded header bytes for every combination of 6-bit data value and postpone sleep flag.
+// Index is the data value with the postpone sleep flag in bit 6, so encoding a header is a single lookup.
+// The table is built at compile time by these macros, so it can never get out of sync with the encoding.
+
+#define IR_HEADER_PARITY7(i)    ( ( (i) ^ ((i)>>1) ^ ((i)>>2) ^ ((i)>>3) ^ ((i)>>4) ^ ((i)>>5) ^ ((i)>>6) ) & 0x01 )
+#define IR_HEADER_ENCODE(i)     ( (i) | ( IR_HEADER_PARITY7(i) ? 0x00 : 0b10000000 ) )      // Top bit ODD parity (including postpone sleep flag)
+
+#define IR_HEADER_ENCODE_8(i)   IR_HEADER_ENCODE((i)+0) , IR_HEADER_ENCODE((i)+1) , IR_HEADER_ENCODE((i)+2) , IR_HEADER_ENCODE((i)+3) , \
+                                IR_HEADER_ENCODE((i)+4) , IR_HEADER_ENCODE((i)+5) , IR_HEADER_ENCODE((i)+6) , IR_HEADER_ENCODE((i)+7)
+
+#define IR_HEADER_ENCODE_32(i)  IR_HEADER_ENCODE_8((i)+0) , IR_HEADER_ENCODE_8((i)+8) , IR_HEADER_ENCODE_8((i)+16) , IR_HEADER_ENCODE_8((i)+24)
+
+static PROGMEM const uint8_t irHeaderEncodeTable[128] = {
+    IR_HEADER_ENCODE_32(0) , IR_HEADER_ENCODE_32(32) , IR_HEADER_ENCODE_32(64) , IR_HEADER_ENCODE_32(96)
+};
+
+// 6th bit is the button pressed flag, top bit is ODD parity
+
 static uint8_t irValueEncode( uint8_t d , uint8_t postponeSleepFlag ) {
-        
+
     if (postponeSleepFlag) {
         d |= 0b01000000;            // 6th bit button pressed flag
     }
-    
-    if ( !oddParity( d )) {
-        
-        d |= 0b10000000;            // Top bit ODD parity (including postpone sleep flag)
-        
-    }
-    
-    return d;
-    
+
+    return pgm_read_byte( &irHeaderEncodeTable[d] );
+
 }
 
 
@@ -153,31 +201,69 @@ static uint8_t irValueDecodePostponeSleepFlag( uint8_t d ) {
 }
 
 
-// TODO: These structs even better if they are padded to a power of 2 like https://stackoverflow.com/questions/1239855/pad-a-c-structure-to-a-power-of-two
-
 #if IR_DATAGRAM_LEN > IR_RX_PACKET_SIZE
     #error IR_DATAGRAM_LEN must not be bigger than IR_RX_PACKET_SIZE
 #endif
 
 // All semantics chosen to have sane startup 0 so we can
-// keep this in bss section and have it zeroed out at startup. 
+// keep this in bss section and have it zeroed out at startup.
+
+// The per-face state is split into hot and cold parts. The hot part is touched on every pass
+// though loop() by RX_IRFaces(), TX_IRFaces(), and isAlone(), so we keep it small and exactly 8 bytes
+// long so indexing into it is just a couple of shifts rather than a multiply.
+// The bulky datagram buffers are only touched when a datagram actually comes or goes, so they live
+// off in their own arrays where they do not get in the way.
 
 struct face_t {
 
-    uint8_t inValue;        // Last received value on this face, or 0 if no neighbor ever seen since startup
-    uint8_t outValue;       // Value we send out on this face
     millis_t expireTime;    // When this face will be considered to be expired (no neighbor there)
     millis_t sendTime;      // Next time we will transmit on this face (set to 0 every time we get a good message so we ping-pong across the link)
-    
-    uint8_t inDatagramLen;  // 0= No datagram waiting to be read
-    uint8_t inDatagramData[IR_DATAGRAM_LEN];
 
-    uint8_t outDatagramLen;  // 0= No datagram waiting to be sent
-    uint8_t outDatagramData[IR_DATAGRAM_LEN];
 };
 
 static face_t faces[FACE_COUNT];
 
+// Snapshot of everything a sketch might want to know about this frame, handed to loopWithState().
+// To keep it free, this is also the real storage for the received face values, datagram lengths,
+// and button state - so the accessor functions below just read out of here too.
+// Not static because the services read it too, but it is only declared for them in hooks.h. Sketches get their copy from loopWithState().
+
+FrameState blinklib_frameState;
+
+static uint8_t faceOutValues[FACE_COUNT];    // Value we send out on this face
+
+struct datagram_t {
+
+    uint8_t len;                            // 0= No datagram waiting
+    uint8_t data[IR_DATAGRAM_LEN];
+
+};
+
+static uint8_t inDatagramData[FACE_COUNT][IR_DATAGRAM_LEN];    // Received datagrams waiting to be read. Lengths are in blinklib_frameState.datagramLengths[]
+static datagram_t outDatagrams[FACE_COUNT];   // Datagrams waiting to be sent
+
+// Link quality tracking. We note each good packet in a bitflag as it comes in and then every LINK_QUALITY_SAMPLE_MS
+// we fold those into an exponentially weighted moving average per face. This way a single missed
+// packet does not make a face look like it came and went.
+
+static uint8_t faceLinkQuality[FACE_COUNT];      // 0-248, higher is better
+
+static uint8_t linkGoodPacketBitflags;            // A 1 here means we got a good packet on this face since the last sample
+// blinklib_frameState.stableFaces has a 1 for each face that is stably connected (with hysteresis)
+
+static millis_t linkQualitySampleTime;            // When we next fold the good packet bits into the averages
+
+// A 1 here means the value on this face was changed and should go out on the very next pass though TX_IRFaces()
+// rather than waiting for the next scheduled sendTime. Cleared when the value gets sent.
+// Faces whose value did not change are not marked, so they keep their normal ping-pong cadence.
+
+static uint8_t outValueChangedBitflags;
+
+// A 1 here means the last thing we sent on this face was a service packet, so the next send should be the
+// face value (or a datagram). This way services can never take more than half of the sends on a face.
+
+static uint8_t serviceSentBitflags;
+
 uint8_t viralButtonPressSendOnFaceBitflags;   // A 1 here means send the viral button press bit on the next IR packet on this face. Cleared when it gets sent. 
 
 Timer viralButtonPressLockoutTimer;     // Set each time we send a viral button press to avoid sending getting into a circular loop
@@ -198,13 +284,24 @@ unsigned long millis() {
     return now;
 }
 
+// Unlike millis(), this reads the BIOS clock live every time
+
+unsigned long micros() {
+    cli();
+    millis_t ms = blinkbios_millis_block.millis;
+    uint8_t steps = blinkbios_millis_block.step_8us;
+    sei();
+
+    return ( ms * 1000UL ) + ( steps * 8U );           // step_8us counts 0-124 within each millisecond
+}
+
 // Returns the inverted checksum of all bytes
 
 uint8_t computePacketChecksum( volatile const uint8_t *buffer , uint8_t len ) {
 
     uint8_t computedChecksum = 0;
 
-    for( uint8_t l=0; l < len ; l++ ) {
+    for( uint8_t l=0; l < len ; l++ ) {         // WCET: 40 (IR_RX_PACKET_SIZE)
 
         computedChecksum += *buffer++;
 
@@ -222,7 +319,7 @@ uint8_t computePacketChecksum( volatile const uint8_t *buffer , uint8_t len ) {
 #endif
 
 byte getDatagramLengthOnFace( uint8_t face ) {    
-    return faces[face].inDatagramLen;
+    return blinklib_frameState.datagramLengths[face];
 }
 
 boolean isDatagramReadyOnFace( uint8_t face ) {
@@ -230,11 +327,11 @@ boolean isDatagramReadyOnFace( uint8_t face ) {
 }
 
 const byte *getDatagramOnFace( uint8_t face ) {
-    return faces[face].inDatagramData;
+    return inDatagramData[face];
 }
 
 void markDatagramReadOnFace( uint8_t face ) {
-    faces[face].inDatagramLen = 0;
+    blinklib_frameState.datagramLengths[face] = 0;
 }    
 
 // Jump to the send packet function all way up in the bootloader
@@ -247,10 +344,6 @@ uint8_t blinkbios_irdata_send_packet(  uint8_t face, const uint8_t *data , uint8
 
 }
 
-#define SBI(x,b) (x|= (1<<b))           // Set bit
-#define CBI(x,b) (x&=~(1<<b))           // Clear bit
-#define TBI(x,b) (x&(1<<b))             // Test bit
-
 void sendDatagramOnFace( const void *data, byte len , byte face ) {
 
     if ( len > IR_DATAGRAM_LEN ) {
@@ -261,10 +354,10 @@ void sendDatagramOnFace( const void *data, byte len , byte face ) {
 
     }
     
-    face_t *f = &faces[face];
+    datagram_t *d = &outDatagrams[face];
     
-    f->outDatagramLen = len;
-    memcpy( f->outDatagramData , data , len ); 
+    d->len = len;
+    memcpy( d->data , data , len ); 
     
 }
 
@@ -415,6 +508,10 @@ static void warm_sleep_cycle() {
     
     // Ensure that we end up completely off 
     setColorNow( OFF );
+
+    // Save the sketch's checkpoint (if it has one) while we look asleep and nobody is waiting on us
+
+    checkpoint_sleep_hook();
         
     // We need to save the time now because it will keep ticking while we are in pre-sleep (where were can get
     // woken back up by a packet). If we did not save it and then restore it later, then all the user timers
@@ -540,22 +637,139 @@ void viralPostponeWarmSleep() {
         
 }
 
+#if ( SERVICE_PAYLOAD_MAX_LEN + 1 ) > IR_DATAGRAM_LEN
+    #error A service packet (ID byte + payload) must fit in ir_send_packet_buffer
+#endif
+
+// Ask each service in turn if it has anything to send on this face. The first one that does
+// writes its payload after the service ID byte in buffer. Returns the length of ID + payload, or 0 if nobody had anything.
+// The services that are not linked in have empty weak hooks, so LTO makes this go away for them.
+
+static uint8_t serviceTX( uint8_t face , uint8_t *buffer ) {
+
+    uint8_t len;
+
+    if ( ( len = neighbor_tx_hook( face , buffer + 1 ) ) ) {
+
+        buffer[0] = SERVICE_ID_NEIGHBOR;
+
+    } else if ( ( len = coord_tx_hook( face , buffer + 1 ) ) ) {
+
+        buffer[0] = SERVICE_ID_COORDS;
+
+    } else if ( ( len = route_tx_hook( face , buffer + 1 ) ) ) {
+
+        buffer[0] = SERVICE_ID_ROUTE;
+
+    } else if ( ( len = token_tx_hook( face , buffer + 1 ) ) ) {
+
+        buffer[0] = SERVICE_ID_TOKEN;
+
+    } else if ( ( len = rank_tx_hook( face , buffer + 1 ) ) ) {
+
+        buffer[0] = SERVICE_ID_RANK;
+
+    } else if ( ( len = epoch_tx_hook( face , buffer + 1 ) ) ) {
+
+        buffer[0] = SERVICE_ID_EPOCH;
+
+    } else if ( ( len = tree_tx_hook( face , buffer + 1 ) ) ) {
+
+        buffer[0] = SERVICE_ID_TREE;
+
+    } else if ( ( len = vote_tx_hook( face , buffer + 1 ) ) ) {
+
+        buffer[0] = SERVICE_ID_VOTE;
+
+    } else if ( ( len = sync_tx_hook( face , buffer + 1 ) ) ) {
+
+        buffer[0] = SERVICE_ID_SYNC;
+
+    } else {
+
+        return 0;
+
+    }
+
+    return len + 1;
+
+}
+
+// Hand a received service packet to the service it is for
+
+static void serviceRX( uint8_t face , uint8_t serviceId , const uint8_t *payload , uint8_t len ) {
+
+    switch ( serviceId ) {
+
+        case SERVICE_ID_NEIGHBOR:
+            neighbor_rx_hook( face , payload , len );
+            break;
+
+        case SERVICE_ID_COORDS:
+            coord_rx_hook( face , payload , len );
+            break;
+
+        case SERVICE_ID_ROUTE:
+            route_rx_hook( face , payload , len );
+            break;
+
+        case SERVICE_ID_TOKEN:
+            token_rx_hook( face , payload , len );
+            break;
+
+        case SERVICE_ID_RANK:
+            rank_rx_hook( face , payload , len );
+            break;
+
+        case SERVICE_ID_EPOCH:
+            epoch_rx_hook( face , payload , len );
+            break;
+
+        case SERVICE_ID_TREE:
+            tree_rx_hook( face , payload , len );
+            break;
+
+        case SERVICE_ID_VOTE:
+            vote_rx_hook( face , payload , len );
+            break;
+
+        case SERVICE_ID_SYNC:
+            sync_rx_hook( face , payload , len );
+            break;
+
+    }
+
+}
+
+// Tell a service that its packet just went out on this face. Like datagrams, this only means we were not
+// interrupted while sending, not that the neighbor got it.
+
+static void serviceSent( uint8_t face , uint8_t serviceId ) {
+
+    switch ( serviceId ) {
+
+        case SERVICE_ID_ROUTE:
+            route_sent_hook( face );
+            break;
+
+    }
+
+}
+
 static void RX_IRFaces() {
 
     //  Use these pointers to step though the arrays
     face_t *face = faces;
     volatile ir_rx_state_t *ir_rx_state = blinkbios_irdata_block.ir_rx_states;
 
+    uint8_t expiredFaces = 0;
+
     for( uint8_t f=0; f < FACE_COUNT ; f++ ) {
 
             // Check for anything new coming in...
 
         if ( ir_rx_state->packetBufferReady ) {
 
-            // Got something, so we know there is someone out there
-            // TODO: Should we require the received packet to pass error checks?
-            face->expireTime = now + RX_EXPIRE_TIME_MS;
-
             // This is slightly ugly. To save a buffer, we get the full packet with the BlinkBIOS IR packet type byte.                       
 
             volatile const uint8_t *packetData = (ir_rx_state->packetBuffer);       
@@ -564,16 +778,22 @@ static void RX_IRFaces() {
             
                 uint8_t packetDataLen = (ir_rx_state->packetBufferLen)-1;               // deduct the BlinkBIOS packet type  byte 
             
-                // blinkBIOS will only pass use packets with len >0 
+                // blinkBIOS should only pass us packets with len >0, but check so we never read a stale header byte
             
                 uint8_t irDataFirstByte = *packetData;                       
                                                                    
-                if (irValueCheckValid( irDataFirstByte )) {                                
+                if ( packetDataLen && irValueCheckValid( irDataFirstByte )) {                                
                 
                     // If we get here, then we know this is a valid packet
+
+                    // Only a packet that passes its checks counts as someone being out there, so noise can not keep a face alive
+                    face->expireTime = now + RX_EXPIRE_TIME_MS;
                 
                     // Clear to send on this face immediately to ping-pong messages at max speed without collisions
                     face->sendTime = 0;
+
+                    // Count towards the link quality on this face
+                    SBI( linkGoodPacketBitflags , f );
                                 
                     if (irValueDecodePostponeSleepFlag(irDataFirstByte )) {
                     
@@ -595,7 +815,7 @@ static void RX_IRFaces() {
 
                         // We got a face value! Save it!
 
-                        face->inValue =decodedByte;
+                        blinklib_frameState.inValues[f] =decodedByte;
 
 
                     } else {        // (packetDataLen>1)  
@@ -604,23 +824,36 @@ static void RX_IRFaces() {
                         if ( decodedByte == DATAGRAM_SPECIAL_VALUE) {
                         
                             uint8_t datagramPayloadLen = packetDataLen-2;           // We deduct 2 from he length to account for the header byte and the trailing checksum byte                        
-                            const uint8_t *datagramPayloadData =   packetData+1;    // Skip the packet header byte
+                            const uint8_t *datagramPayloadData =   (const uint8_t *) packetData+1;    // Skip the packet header byte
                         
                             // Long packets are kind of a special case since we do not mark them read immediately
                             if ( computePacketChecksum( datagramPayloadData , datagramPayloadLen )  ==  datagramPayloadData[ datagramPayloadLen ] ) {        // Run checksum on payload bytes after the header, compare that to the checksum at the end
 
                                 // Ok this packet checks out folks!
                             
-                                if ( face->inDatagramLen == 0 && !(datagramPayloadLen > IR_DATAGRAM_LEN) ) {        // Check if buffer free and datagram not too long
+                                if ( blinklib_frameState.datagramLengths[f] == 0 && !(datagramPayloadLen > IR_DATAGRAM_LEN) ) {        // Check if buffer free and datagram not too long
 
-                                    face->inDatagramLen = datagramPayloadLen;
+                                    blinklib_frameState.datagramLengths[f] = datagramPayloadLen;
                                 
-                                    memcpy( face->inDatagramData  , datagramPayloadData , datagramPayloadLen);       // Skip the header bytes
+                                    memcpy( inDatagramData[f]  , datagramPayloadData , datagramPayloadLen);       // Skip the header bytes (cold data, so only indexed once we know we need it)
+
+                                    datagram_rx_hook( f );
                                     
                                 }
                                                                                     
                             }
 
+                        } else if ( decodedByte == SERVICE_SPECIAL_VALUE && packetDataLen >= 3 ) {
+
+                            uint8_t serviceLen = packetDataLen-2;                   // Service ID + payload, without header and checksum
+                            const uint8_t *serviceData = (const uint8_t *) packetData+1;     // Not volatile, the BIOS leaves the buffer alone until we mark it read
+
+                            if ( computePacketChecksum( serviceData , serviceLen ) == serviceData[ serviceLen ] ) {
+
+                                serviceRX( f , serviceData[0] , serviceData+1 , serviceLen-1 );
+
+                            }
+
                         } else {    // packetLen > 1 &&  decodedByte != LONG_DATA_SPECIAL_VALUE
                             
                             // Here is look for a magic packet that has 2 bytes of data and both are the special sleep trigger cookie
@@ -651,14 +884,67 @@ static void RX_IRFaces() {
                         
         }  // if ( ir_data_buffer->ready_flag )
 
+        // While we are here, note if this face is expired for the frame snapshot
+
+        if ( face->expireTime < now ) {
+
+            SBI( expiredFaces , f );
+
+        }
+
         face++;
         ir_rx_state++;
 
     } // for( uint8_t f=0; f < FACE_COUNT ; f++ )
 
+    blinklib_frameState.expiredFaces = expiredFaces;
+
 }
 
 
+// Fold the good packets seen since the last sample into the link quality averages.
+// Only does work once every LINK_QUALITY_SAMPLE_MS, so cheap to call every pass.
+
+static void updateLinkQuality() {
+
+    if ( linkQualitySampleTime > now ) {
+        return;
+    }
+
+    linkQualitySampleTime = now + LINK_QUALITY_SAMPLE_MS;
+
+    uint8_t *quality = faceLinkQuality;
+
+    FOREACH_FACE(f) {
+
+        uint8_t q = *quality;
+
+        q -= q >> LINK_QUALITY_EWMA_SHIFT;          // Decay towards 0...
+
+        if ( TBI( linkGoodPacketBitflags , f ) ) {
+
+            q += LINK_QUALITY_SAMPLE_GOOD;          // ...unless we heard from this neighbor
+
+        }
+
+        if ( q > LINK_QUALITY_STABLE_ABOVE ) {
+
+            SBI( blinklib_frameState.stableFaces , f );
+
+        } else if ( q < LINK_QUALITY_STABLE_BELOW ) {
+
+            CBI( blinklib_frameState.stableFaces , f );
+
+        }
+
+        *quality++ = q;
+
+    }
+
+    linkGoodPacketBitflags = 0;
+
+}
+
 // Buffer to build each outgoing IR packet
 // This is the easy way to do this, but uses RAM unnecessarily.
 // TODO: Make a scatter version of this to save RAM & time
@@ -674,27 +960,30 @@ static void TX_IRFaces() {
         
         // Send one out too if it is time....
 
-        if ( face->sendTime <= now ) {        // Time to send on this face?
+        if ( face->sendTime <= now || TBI( outValueChangedBitflags , f ) ) {        // Time to send on this face? Or a changed value waiting to go out promptly?
                                               // Note that we do not use the rx_fresh flag here because we want the timeout
                                               // to do automatic retries to kickstart things when a new neighbor shows up or
                                               // when an IR message gets missed
                    
             uint8_t outgoingPacketLen;              // Total length of the outgoing packet in ir_send_packet_buffer
             uint8_t outgoiungPacketHeaderValue;     // Value to encode into first byte of outgoing IR packet before transmitting
+            uint8_t serviceLen = 0;                 // Length of service ID + payload if we are sending a service packet
                                                                       
             // Ok, it is time to send something on this face
             // Do we have a pending datagram? If so, datagrams get priority over face values
                                     
-            if (face->outDatagramLen) {
+            datagram_t *outDatagram = &outDatagrams[f];         // Cold data, so only look it up once we know we are sending
+
+            if (outDatagram->len) {
                 
                 outgoiungPacketHeaderValue = DATAGRAM_SPECIAL_VALUE;
 
                 // Build a datagram into the outgoing buffer including checksum
                                 
                 uint8_t *d = ir_send_packet_buffer+1;           // Data goes after the 1st byte header            
-                const uint8_t *s = face->outDatagramData ;      // Just to convert from void to uint8_t
+                const uint8_t *s = outDatagram->data ;          // Just to convert from void to uint8_t
 
-                uint8_t datagramPayloadLen  = face->outDatagramLen;
+                uint8_t datagramPayloadLen  = outDatagram->len;
                                 
                 memcpy( d, s , datagramPayloadLen );
                                                 
@@ -706,10 +995,33 @@ static void TX_IRFaces() {
                 // Note that the outgoing datagram buffer will be cleared below if the IR send succeeds
                 
             } else {    
-                
-                // Just send a normal face value                                
-                outgoiungPacketHeaderValue = face->outValue;
-                outgoingPacketLen=1;
+
+                // A changed face value gets this send ahead of any service, otherwise a service packet
+                // that happened to be due would push the change back a whole turn
+
+                if ( !TBI( serviceSentBitflags , f ) && !TBI( outValueChangedBitflags , f ) ) {
+
+                    serviceLen = serviceTX( f , ir_send_packet_buffer+1 );
+
+                }
+
+                if ( serviceLen ) {
+
+                    // A service had something to say
+
+                    outgoiungPacketHeaderValue = SERVICE_SPECIAL_VALUE;
+
+                    ir_send_packet_buffer[1+serviceLen] = computePacketChecksum( ir_send_packet_buffer+1 , serviceLen );
+
+                    outgoingPacketLen = 1 + serviceLen + 1;
+
+                } else {
+
+                    // Just send a normal face value
+                    outgoiungPacketHeaderValue = faceOutValues[f];
+                    outgoingPacketLen=1;
+
+                }
                                 
             }       
 
@@ -735,6 +1047,8 @@ static void TX_IRFaces() {
             ir_send_packet_buffer[0] = encodedIrValue;  // store the encoded header into the outgoing buffer
 
             if (blinkbios_irdata_send_packet( f , ir_send_packet_buffer  , outgoingPacketLen ) ) {
+
+                energy_ir_tx_hook( outgoingPacketLen );
                 
                 // Here we set a timeout to keep periodically probing on this face, but
                 // if there is a neighbor, they will send back to us as soon as they get what we
@@ -753,13 +1067,33 @@ static void TX_IRFaces() {
                 
                 
                 // Mark any pending datagram as sent
-                // safe to do this blindly because datagram always gets priority so it would have been 
+                // safe to do this because datagram always gets priority so it would have been 
                 // what was just sent if there was one pending
-                face->outDatagramLen = 0;
+
+                if (outDatagram->len) {
+
+                    outDatagram->len = 0;
+
+                } else if ( serviceLen ) {
+
+                    // Take turns so the value always gets the next send after a service packet
+
+                    SBI( serviceSentBitflags , f );
+
+                    serviceSent( f , ir_send_packet_buffer[1] );
+
+                } else {
+
+                    // We just sent the current value, so any prompt send for a changed value is done
+
+                    CBI( outValueChangedBitflags , f );
+                    CBI( serviceSentBitflags , f );
+
+                }
                 
             }
 
-        } // if ( face->sendTime <= now )
+        } // if ( face->sendTime <= now || TBI( outValueChangedBitflags , f ) )
 
         face++;
 
@@ -776,7 +1110,7 @@ static void TX_IRFaces() {
 
 byte getLastValueReceivedOnFace( byte face ) {
 
-    return faces[face].inValue;
+    return blinklib_frameState.inValues[face];
 
 }
 
@@ -811,24 +1145,77 @@ byte isValueReceivedOnFaceExpired( byte face ) {
 
 bool isAlone() {
 
-	FOREACH_FACE(f) {
+    // Step though the hot face array with a pointer rather than indexing
 
-		if( !isValueReceivedOnFaceExpired(f) ) {
-			return false;
-		}
+    const face_t *face = faces;
 
-	}
-	return true;
+    FOREACH_FACE(f) {
+
+        if( !( face->expireTime < now ) ) {
+            return false;
+        }
+
+        face++;
+
+    }
+    return true;
 
 }
 
 
-// Set our broadcasted state on all faces to newState.
-// This state is repeatedly broadcast to any neighboring tiles.
+// Smoothed rate of good packets received on this face. 0-248, higher is better.
 
-// By default we power up in state 0.
+byte getFaceLinkQuality( byte face ) {
 
-void setValueSentOnAllFaces( byte value ) {
+    return faceLinkQuality[face];
+
+}
+
+// True if we have been hearing from a neighbor on this face reliably.
+// Has hysteresis so a few missed packets will not make it flip.
+
+bool isFaceStablyConnected( byte face ) {
+
+    return TBI( blinklib_frameState.stableFaces , face );
+
+}
+
+
+// Set the values sent on all faces in one shot from an array of FACE_COUNT values.
+// Only faces whose value actually changed get marked for a prompt send.
+
+void setValuesSentOnFaces( const byte *values ) {
+
+    uint8_t *outValue = faceOutValues;
+
+    FOREACH_FACE(f) {
+
+        byte value = *values++;
+
+        if (value > IR_DATA_VALUE_MAX ) {
+
+            value = IR_DATA_VALUE_MAX;
+
+        }
+
+        if ( *outValue != value ) {
+
+            *outValue = value;
+
+            SBI( outValueChangedBitflags , f );
+
+        }
+
+        outValue++;
+
+    }
+
+}
+
+// Set the value sent on every face that has a 1 in the corresponding bit of faceMask.
+// Bit 0 is face 0. Only faces whose value actually changed get marked for a prompt send.
+
+void setValueSentOnFaces( byte value , byte faceMask ) {
 
      if (value > IR_DATA_VALUE_MAX ) {
 
@@ -836,19 +1223,44 @@ void setValueSentOnAllFaces( byte value ) {
 
      }
 
+    uint8_t *outValue = faceOutValues;
+
     FOREACH_FACE(f) {
 
-        faces[f].outValue = value;
+        if ( TBI( faceMask , f ) && *outValue != value ) {
+
+            *outValue = value;
+
+            SBI( outValueChangedBitflags , f );
+
+        }
+
+        outValue++;
 
     }
 
 }
 
+// Set our broadcasted state on all faces to newState.
+// This state is repeatedly broadcast to any neighboring tiles.
+
+// By default we power up in state 0.
+
+void setValueSentOnAllFaces( byte value ) {
+
+    setValueSentOnFaces( value , IR_FACE_BITMASK );
+
+}
+
 // Set our broadcasted state on indicated face to newState.
 // This state is repeatedly broadcast to the partner tile on the indicated face.
 
 // By default we power up in state 0.
 
+// If the value changed, then it goes out on this face in the very next TX_IRFaces() rather than
+// waiting for the next ping-pong or probe. If there is an RX in progress on the face at that moment
+// then the BIOS will refuse to send and we will try again on the next pass.
+
 void setValueSentOnFace( byte value , byte face ) {
 
      if (value > IR_DATA_VALUE_MAX ) {
@@ -857,7 +1269,13 @@ void setValueSentOnFace( byte value , byte face ) {
 
      }
 
-    faces[face].outValue = value;
+    if ( faceOutValues[face] != value ) {
+
+        faceOutValues[face] = value;
+
+        SBI( outValueChangedBitflags , face );
+
+    }
 
 }
 
@@ -868,15 +1286,19 @@ void setValueSentOnFace( byte value , byte face ) {
 
 // Here we keep a local snapshot of the button block stuff
 
-static uint8_t buttonSnapshotDown;               // 1 if button is currently down (debounced)
+// The current button down state and click count live in blinklib_frameState.buttonDown and blinklib_frameState.clickCount
 
-static uint8_t buttonSnapshotBitflags;
+static uint8_t buttonSnapshotBitflags;          // Button flags that have not been consumed yet by the button functions below
 
-static uint8_t buttonSnapshotClickcount;         // Number of clicks on most recent multiclick
+#if BUTTON_EVENT_PRESSED != BUTTON_BITFLAG_PRESSED || BUTTON_EVENT_LONGPRESSED != BUTTON_BITFLAG_LONGPRESSED || BUTTON_EVENT_RELEASED != BUTTON_BITFLAG_RELEASED || \
+    BUTTON_EVENT_SINGLECLICKED != BUTTON_BITFLAG_SINGLECLICKED || BUTTON_EVENT_DOUBLECLICKED != BUTTON_BITFLAG_DOUBLECLICKED ||                                  \
+    BUTTON_EVENT_MULTICLICKED != BUTTON_BITFLAG_MULITCLICKED || BUTTON_EVENT_LONGLONGPRESSED != BUTTON_BITFLAG_3SECPRESSED
+    #error The BUTTON_EVENT_* flags in FrameState must match the BIOS BUTTON_BITFLAG_* flags
+#endif
 
 
 bool buttonDown(void) {
-    return buttonSnapshotDown != 0;
+    return blinklib_frameState.buttonDown != 0;
 }
 
 static bool grabandclearbuttonflag( uint8_t flagbit ) {
@@ -908,7 +1330,7 @@ bool buttonMultiClicked() {
 
 // The number of clicks in the longest consecutive valid click cycle since the last time called.
 byte buttonClickCount(void) {
-    return buttonSnapshotClickcount;
+    return blinklib_frameState.clickCount;
 }
 
 // Remember that a long press fires while the button is still down
@@ -1011,7 +1433,7 @@ void randomize() {
     // The WDT timer is now generating an interrupt about every 16ms
     // https://electronics.stackexchange.com/a/322817    
     
-    for( uint8_t bit=32; bit; bit-- ) {
+    for( uint8_t bit=32; bit; bit-- ) {         // WCET: 32
                                
         blinkbios_pixel_block.capturedEntropy=0;                                                          // Clear this so we can check to see when it gets set in the background               
         while (blinkbios_pixel_block.capturedEntropy==0 || blinkbios_pixel_block.capturedEntropy==1  );   // Wait for this to get set in the background when the WDT ISR fires
@@ -1132,8 +1554,20 @@ word map(word x, word in_min, word in_max, word out_min, word out_max)
 // As per "13.6.8.1. SNOBRx - Serial Number Byte 8 to 0"
 
 
+#ifdef __AVR__
+
 const byte * const serialno_addr = ( const byte *)   0xF0;
 
+#else
+
+// Host builds have no signature row, so the simulated BIOS in tools/hostsim makes one up
+
+extern const byte hostbios_serial_number[];
+
+const byte * const serialno_addr = hostbios_serial_number;
+
+#endif
+
 
 // Read the unique serial number for this blink tile
 // There are 9 bytes in all, so n can be 0-8
@@ -1147,6 +1581,44 @@ byte getSerialNumberByte( byte n ) {
 
 }
 
+// A short ID made by hashing the serial number. We only work it out the first time.
+//
+// The serial number is lot, wafer, and die X and Y, so tiles from the same batch differ in only a couple of bytes.
+// A simple multiply and add hash lines those bytes up so that neighboring dies collide, so we use 32 bit FNV-1a,
+// which mixes every bit of every byte, and fold it down to 16 bits.
+
+#define TILE_ID_FNV_OFFSET  2166136261UL
+#define TILE_ID_FNV_PRIME   16777619UL
+
+static word tileId;
+
+word getTileId() {
+
+    if ( !tileId ) {
+
+        uint32_t hash = TILE_ID_FNV_OFFSET;
+
+        for( uint8_t n = 0 ; n < SERIAL_NUMBER_LEN ; n++ ) {
+
+            hash ^= serialno_addr[n];
+            hash *= TILE_ID_FNV_PRIME;
+
+        }
+
+        word id = (word) ( hash >> 16 ) ^ (word) hash;
+
+        if ( id == NO_TILE_ID ) {       // Reserved so it can mean "nobody"
+            id = 1;
+        }
+
+        tileId = id;
+
+    }
+
+    return tileId;
+
+}
+
 // Returns the currently blinkbios version number. 
 // Useful to check is a newer feature is available on this blink.
 
@@ -1322,6 +1794,125 @@ byte sin8_C( byte theta)
 
 #endif
 
+// Empty defaults for the optional service hooks. See hooks.h for how these get replaced.
+
+void __attribute__((weak)) battery_loop_hook() {
+}
+
+void __attribute__((weak)) neighbor_loop_hook() {
+}
+
+uint8_t __attribute__((weak)) neighbor_tx_hook( uint8_t /*face*/ , uint8_t * /*payload*/ ) {
+    return 0;
+}
+
+void __attribute__((weak)) neighbor_rx_hook( uint8_t /*face*/ , const uint8_t * /*payload*/ , uint8_t /*len*/ ) {
+}
+
+void __attribute__((weak)) coord_loop_hook() {
+}
+
+uint8_t __attribute__((weak)) coord_tx_hook( uint8_t /*face*/ , uint8_t * /*payload*/ ) {
+    return 0;
+}
+
+void __attribute__((weak)) coord_rx_hook( uint8_t /*face*/ , const uint8_t * /*payload*/ , uint8_t /*len*/ ) {
+}
+
+void __attribute__((weak)) route_loop_hook() {
+}
+
+uint8_t __attribute__((weak)) route_tx_hook( uint8_t /*face*/ , uint8_t * /*payload*/ ) {
+    return 0;
+}
+
+void __attribute__((weak)) route_rx_hook( uint8_t /*face*/ , const uint8_t * /*payload*/ , uint8_t /*len*/ ) {
+}
+
+void __attribute__((weak)) route_sent_hook( uint8_t /*face*/ ) {
+}
+
+void __attribute__((weak)) token_loop_hook() {
+}
+
+uint8_t __attribute__((weak)) token_tx_hook( uint8_t /*face*/ , uint8_t * /*payload*/ ) {
+    return 0;
+}
+
+void __attribute__((weak)) token_rx_hook( uint8_t /*face*/ , const uint8_t * /*payload*/ , uint8_t /*len*/ ) {
+}
+
+void __attribute__((weak)) rank_loop_hook() {
+}
+
+uint8_t __attribute__((weak)) rank_tx_hook( uint8_t /*face*/ , uint8_t * /*payload*/ ) {
+    return 0;
+}
+
+void __attribute__((weak)) rank_rx_hook( uint8_t /*face*/ , const uint8_t * /*payload*/ , uint8_t /*len*/ ) {
+}
+
+void __attribute__((weak)) epoch_loop_hook() {
+}
+
+uint8_t __attribute__((weak)) epoch_tx_hook( uint8_t /*face*/ , uint8_t * /*payload*/ ) {
+    return 0;
+}
+
+void __attribute__((weak)) epoch_rx_hook( uint8_t /*face*/ , const uint8_t * /*payload*/ , uint8_t /*len*/ ) {
+}
+
+void __attribute__((weak)) tree_loop_hook() {
+}
+
+uint8_t __attribute__((weak)) tree_tx_hook( uint8_t /*face*/ , uint8_t * /*payload*/ ) {
+    return 0;
+}
+
+void __attribute__((weak)) tree_rx_hook( uint8_t /*face*/ , const uint8_t * /*payload*/ , uint8_t /*len*/ ) {
+}
+
+void __attribute__((weak)) vote_loop_hook() {
+}
+
+uint8_t __attribute__((weak)) vote_tx_hook( uint8_t /*face*/ , uint8_t * /*payload*/ ) {
+    return 0;
+}
+
+void __attribute__((weak)) vote_rx_hook( uint8_t /*face*/ , const uint8_t * /*payload*/ , uint8_t /*len*/ ) {
+}
+
+void __attribute__((weak)) sync_loop_hook() {
+}
+
+uint8_t __attribute__((weak)) sync_tx_hook( uint8_t /*face*/ , uint8_t * /*payload*/ ) {
+    return 0;
+}
+
+void __attribute__((weak)) sync_rx_hook( uint8_t /*face*/ , const uint8_t * /*payload*/ , uint8_t /*len*/ ) {
+}
+
+void __attribute__((weak)) datagram_rx_hook( uint8_t /*face*/ ) {
+}
+
+void __attribute__((weak)) checkpoint_sleep_hook() {
+}
+
+void __attribute__((weak)) brightness_display_begin_hook() {
+}
+
+void __attribute__((weak)) brightness_display_end_hook() {
+}
+
+void __attribute__((weak)) energy_display_begin_hook() {
+}
+
+void __attribute__((weak)) energy_display_end_hook() {
+}
+
+void __attribute__((weak)) energy_ir_tx_hook( uint8_t /*len*/ ) {
+}
+
 uint8_t __attribute__((weak)) sterileFlag = 0;             // Set to 1 to make this game sterile. Hopefully LTO will compile this away for us? (update: Whooha yes! )
                                                            // We make `weak` so that the user program can override it
 
@@ -1427,20 +2018,52 @@ void __attribute__((noreturn)) run(void)  {
         // Receive any pending packets
         RX_IRFaces();
 
+        updateLinkQuality();
+
+        battery_loop_hook();
+
+        neighbor_loop_hook();
+
+        coord_loop_hook();
+
+        route_loop_hook();
+
+        token_loop_hook();
+
+        rank_loop_hook();
+
+        epoch_loop_hook();
+
+        tree_loop_hook();
+
+        vote_loop_hook();
+
+        sync_loop_hook();
+
         cli();
-        buttonSnapshotDown       = blinkbios_button_block.down;
-        buttonSnapshotBitflags  |= blinkbios_button_block.bitflags;     // Or any new flags into the ones we got
+        blinklib_frameState.buttonDown    = blinkbios_button_block.down;
+        blinklib_frameState.buttonEvents  = blinkbios_button_block.bitflags;     // Just the new flags for this frame
         blinkbios_button_block.bitflags=0;                              // Clear out the flags now that we have them
-        buttonSnapshotClickcount = blinkbios_button_block.clickcount;
+        blinklib_frameState.clickCount    = blinkbios_button_block.clickcount;
         sei();
 
+        buttonSnapshotBitflags  |= blinklib_frameState.buttonEvents;            // Or any new flags into the ones we got
 
-        loop();
+        blinklib_frameState.millis = now;
+
+        loopWithState( blinklib_frameState );        // Calls loop() unless the sketch supplies its own loopWithState()
 
         // Update the pixels to match our buffer
+        // This waits for the next vertical blanking interval, so it is also where we idle
+
+        brightness_display_begin_hook();
+        energy_display_begin_hook();
 
         BLINKBIOS_DISPLAY_PIXEL_BUFFER_VECTOR();
 
+        energy_display_end_hook();
+        brightness_display_end_hook();
+
         // Transmit any IR packets waiting to go out
         // Note that we do this after loop had a chance to update them.
         TX_IRFaces();
@@ -1455,3 +2078,49 @@ void __attribute__((noreturn)) run(void)  {
 
 
 }
+
+#ifndef __AVR__
+
+// Host builds (see tools/hostsim) need to know when we next send or time out a face, so that fast forward
+// does not jump past it. This has to live in here since the face timers are static.
+// Not counted against the sketch since it is not something that runs on a tile.
+
+#include "hostcore.h"
+
+bool __attribute__((no_sanitize_coverage)) hostcore_deadlines() {
+
+    if ( now != blinkbios_millis_block.millis ) {
+
+        return false;
+
+    }
+
+    face_t *face = faces;
+
+    for( uint8_t f = 0 ; f < FACE_COUNT ; f++ ) {
+
+        if ( face->sendTime <= now || TBI( outValueChangedBitflags , f ) ) {
+
+            // About to send on this face, which will put the next send off until...
+
+            hostbios_millis_deadline( now + TX_PROBE_TIME_MS + f );
+
+        } else {
+
+            hostbios_millis_deadline( face->sendTime );
+
+        }
+
+        hostbios_millis_deadline( face->expireTime + 1 );           // Expired once now is past expireTime
+
+        face++;
+
+    }
+
+    hostbios_millis_deadline( linkQualitySampleTime );
+
+    return true;
+
+}
+
+#endif
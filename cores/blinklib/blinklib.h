@@ -58,10 +58,26 @@ byte isValueReceivedOnFaceExpired( byte face );
 // Returns false if their has been a neighbor seen recently on any face, returns true otherwise.
 bool isAlone();
 
+// How well we have been hearing from the neighbor on this face recently.
+// This is a smoothed average of the rate of good packets received, from 0 (nothing heard)
+// up to 248 (a good packet every sample period). It ramps up over a few hundred ms after a
+// neighbor arrives and back down after it leaves.
+
+byte getFaceLinkQuality( byte face );
+
+// true if we have been reliably hearing from a neighbor on this face.
+// Unlike isValueReceivedOnFaceExpired(), this has hysteresis so a couple of missed
+// packets on a flaky link will not make it flip back and forth. Good to check before
+// kicking off expensive work because a neighbor seemed to come or go.
+
+bool isFaceStablyConnected( byte face );
+
 // Set value that will be continuously broadcast on specified face.
 // Value should be between 0 and IR_DATA_VALUE_MAX inclusive.
 // If a value greater than IR_DATA_VALUE_MAX is specified, IR_DATA_VALUE_MAX will be sent.
 // By default we power up with all faces sending the value 0.
+// A changed value is sent right after loop() returns rather than waiting for the next regularly scheduled send,
+// so neighbors see the change as soon as possible.
 
 void setValueSentOnFace( byte value , byte face );
 
@@ -69,6 +85,17 @@ void setValueSentOnFace( byte value , byte face );
 
 void setValueSentOnAllFaces( byte value );
 
+// Set a different value on each face in one call. `values` points to an array of FACE_COUNT values,
+// one per face starting with face 0. Values are clamped to IR_DATA_VALUE_MAX like setValueSentOnFace().
+// Faces whose value changed are sent promptly on the next pass, unchanged faces keep their normal timing.
+
+void setValuesSentOnFaces( const byte *values );
+
+// Set the same value on several faces in one call. Bit 0 of faceMask is face 0, bit 1 is face 1, etc.
+// Faces whose value changed are sent promptly on the next pass, unchanged faces keep their normal timing.
+
+void setValueSentOnFaces( byte value , byte faceMask );
+
 /* --- Datagram processing */
 
 // A datagram is a set of 1-IR_DATAGRAM_MAX_LEN bytes that are atomically sent over the IR link
@@ -93,6 +120,14 @@ boolean isDatagramReadyOnFace( uint8_t face );
  // Thanks, Stroustrup.
 const byte *getDatagramOnFace( uint8_t face );
 
+// Returns the time the datagram waiting on this face was picked up from the BIOS, in the same units as micros().
+// We pick up packets at the start of each pass, just before loop(), so this is really the start of the pass it
+// showed up in. The BIOS does not tell us when a packet arrived, so it could have come in any time during the
+// pass before. Only good to within one pass. Only valid while isDatagramReadyOnFace() is true.
+// Keeping the times costs 24 bytes of RAM, but only if your sketch calls this.
+
+unsigned long getDatagramTimeOnFace( uint8_t face );
+
 // Frees up the buffer holding the datagram data. Do this as soon as possible after you have
 // processed the datagram to free up the slot for the next incoming datagram on this face.
 // If a new datagram is recieved on a face before markDatagramReadOnFace() is called then
@@ -100,6 +135,171 @@ const byte *getDatagramOnFace( uint8_t face );
 
 void markDatagramReadOnFace( uint8_t face );
 
+// Optional services.
+//
+// The neighbor, coordinate, routing, token, rank, epoch, vote, shared frame, battery, energy and checkpoint
+// functions in this file each live in their own .cpp file, and only get linked in if your sketch calls one
+// of them. A sketch only pays flash and RAM for the services it actually uses.
+
+// Find out who is across a face.
+//
+// Whenever a face connects to another tile, the two tiles quietly swap their tile IDs (see getTileId())
+// and which face each is using. This only happens when the link comes up, so it does not use up your
+// datagrams and costs almost nothing after that.
+
+// Returns the tile ID of the neighbor on this face, or NO_TILE_ID if we do not know it (yet).
+
+word getNeighborId( byte face );
+
+// Returns which of the neighbor's faces is touching this face, or NO_NEIGHBOR_FACE if we do not know it (yet).
+
+#define NO_NEIGHBOR_FACE FACE_COUNT
+
+byte getNeighborFace( byte face );
+
+// Returns true once each time a different tile (or a different face of the same tile) shows up on this face,
+// including the first time we find out who is there.
+
+bool didNeighborSwapOnFace( byte face );
+
+// Hex grid coordinates.
+//
+// Make one tile the root and every connected tile will work out its (q,r) position relative to it
+// using axial hex coordinates, one IR hop at a time. The root is at (0,0) and its face 0 points in global
+// direction 0. Taking one step out of a face pointing in global direction...
+//
+//      0 is (0,-1)   1 is (+1,-1)   2 is (+1,0)   3 is (0,+1)   4 is (-1,+1)   5 is (-1,0)
+//
+// If more than one tile is made root, the one with the lowest tile ID wins.
+
+void setCoordinateRoot( bool rootFlag );
+
+// True once this tile knows where it is
+
+bool hasCoordinates();
+
+int8_t getCoordinateQ();
+int8_t getCoordinateR();
+
+// Which global direction this tile's face 0 points. Face f points in global direction rotateFace( f , getCoordinateOrientation() ).
+
+byte getCoordinateOrientation();
+
+// True if the tiles are arranged in a way that can not lie flat on a hex grid, so different paths
+// back to the root disagree about where this tile is.
+
+bool isCoordinateConflict();
+
+// Send a short message to any tile in the group by its tile ID (see getTileId()).
+//
+// Tiles quietly trade a little routing information with their neighbors, so each one learns which face leads
+// toward each tile it has heard of. A message is passed along only the tiles on the way to where it is going.
+// Like datagrams, messages are best effort and can get lost. Each tile only keeps track of the nearest dozen
+// or so tiles. Does not use up your datagrams.
+
+#define ROUTE_DATA_MAX_LEN 9
+
+// Returns true if the message was queued. Returns false if we do not know a way to that tile yet,
+// or if we are still busy passing along a previous message.
+
+bool sendToTile( word id , const void *data , byte len );
+
+// How many hops away the tile is, or NO_ROUTE_HOPS if we do not know a way to get there.
+
+#define NO_ROUTE_HOPS 0xff
+
+byte getHopsToTile( word id );
+
+// Returns the length of a message that came in for us, or 0 if there is none.
+// Only one message is held at a time - any more that come before you call markTileMessageRead() are dropped.
+
+byte getTileMessageLength();
+
+const byte *getTileMessage();
+
+// Tile ID of the tile that sent the message
+
+word getTileMessageSource();
+
+void markTileMessageRead();
+
+// Pass a turn around the group, for turn based games.
+//
+// Exactly one tile in a connected group has the token at a time. It goes to every tile in turn, one
+// IR hop per move, and comes back around again. If the tile holding it is pulled away, the rest of the
+// group makes a new one after a few seconds. If two groups are pushed together, one of the tokens goes away.
+
+// True if it is our turn
+
+bool haveToken();
+
+// Done with our turn. Sends the token on to the next tile. Does nothing if we do not have it.
+
+void passToken();
+
+// Give every tile in the group a different number from 0 to getClusterSize()-1, like "player 0", "player 1"...
+//
+// Tiles that start up together are numbered in tile ID order. A tile added later gets the next number
+// up so nobody else's number changes. When a tile leaves, the numbers after it slide down to fill in
+// (this takes about 15 seconds to notice). Numbers can move around during the first few seconds while
+// the tiles find each other. If two tiles in the group have the same tile ID, they notice and number themselves
+// by a fresh hash of their serial numbers instead, which can shuffle the numbers once and makes the group look one
+// bigger until their old entries time out. Works with up to 21 tiles.
+
+byte getRank();
+
+byte getClusterSize();
+
+// Find out when two groups of tiles that were apart get pushed together.
+//
+// Each connected group keeps an epoch led by one of its tiles. When a link joins two groups that were apart
+// for more than a few seconds, both groups move to a new epoch and every tile in both groups gets exactly one
+// call to the handler. The group whose leader has the lower tile ID wins - its tiles are called with won=true
+// and usually keep their game state, and the other group's tiles are called with won=false and usually
+// take on the winners' state. The handler is called from outside loop(), just before it.
+
+void setClusterMergeHandler( void (*handler)( bool won ) );
+
+// Tile ID of the tile leading our group's epoch
+
+word getClusterLeader();
+
+// Let the group agree on a value by vote, like which level to play next.
+//
+// Each tile votes for a value from 0 to VOTE_VALUE_COUNT-1. Once every tile in the group has voted, every tile
+// gets the same result - the value with the most votes, with the lowest value winning a tie. Until then the
+// result is NO_VOTE. Changing a vote or adding or removing a tile redoes the count, and the new result takes
+// a moment to reach everyone.
+
+#define VOTE_VALUE_COUNT 8
+
+#define NO_VOTE 0xff
+
+// Pass NO_VOTE to take back our vote
+
+void castVote( byte value );
+
+byte getVoteResult();
+
+// A frame counter shared by the whole group, for light shows where every tile should show the same frame at the same time.
+//
+// Frames are SHARED_FRAME_MS long. Connected tiles keep their frame counters lined up with each other, usually
+// to within a few ms. When two groups are pushed together, the group that is behind jumps ahead to match the other,
+// so the frame number never goes backwards.
+
+#define SHARED_FRAME_MS 32
+
+word getSharedFrame();
+
+// How far we are into the current frame, from 0 at the start to 255 at the very end
+
+byte getSharedFramePhase();
+
+// How well the sync is working. The worst difference in ms between our clock and a neighbor's over the last
+// second or so. 0 if we have no neighbors.
+
+byte getSharedFrameError();
+
 // Send a datagram.  
 // Datagram is sent as soon as possible and takes priority over sending a value on face.
 // If you call sendDatagramOnFace() and there is already a pending datagram, the older pending
@@ -240,6 +440,21 @@ void setColor( Color newColor);
 
 void setColorOnFace( Color newColor , byte face );
 
+// Scale the brightness of everything shown on the tile. Brightness is 0-255 (0=off, 255=full brightness, the default)
+// This is applied when the display is updated after loop() returns, so the colors you set and read
+// back are not changed. Lower brightness makes the battery last longer.
+
+void setGlobalBrightness( byte brightness );
+
+// Limit the total LED load. The budget is the most that all the R, G, and B levels (0-31) on all
+// the faces are allowed to add up to, after global brightness is applied. If a frame would go over,
+// the whole frame is dimmed evenly to fit. Default is MAX_POWER_BUDGET, which is no limit.
+// For example, MAX_POWER_BUDGET/3 would let the tile show full white on two faces, or dim white on all six.
+
+#define MAX_POWER_BUDGET ( FACE_COUNT * 3 * MAX_BRIGHTNESS_5BIT )
+
+void setPowerBudget( word levels );
+
 // DEPREICATED: Use setColorOnFace()
 //void setFaceColor( byte face , Color newColor ) __attribute__ ((deprecated));
 void setFaceColor(  byte face, Color newColor );
@@ -262,6 +477,14 @@ void setFaceColor(  byte face, Color newColor );
 
 unsigned long millis(void);
 
+// Number of microseconds since power up, with 8us resolution.
+//
+// Unlike millis(), this is read fresh every time you call it, so it moves even
+// inside loop(). Same as millis() it does not increment while sleeping,
+// overflows (after about 71 minutes) and is only accurate to about +/-10%.
+
+unsigned long micros(void);
+
 class Timer {
 
 	private:
@@ -322,6 +545,15 @@ byte getSerialNumberByte( byte n );
 
 byte getBlinkbiosVersion();
 
+// A short ID for this tile made from its serial number. Handy for telling tiles apart in
+// multi-tile games. It is only 16 bits, so any two tiles have about a 1 in 65536 chance of getting the
+// same ID (and in a big pile of tiles, the odds that some pair matches are a lot higher). If you really
+// need to know two tiles apart, compare serial numbers. Never returns NO_TILE_ID.
+
+#define NO_TILE_ID 0
+
+word getTileId();
+
 // Map one set to another
 // Note that this explodes to big code, so do the explicit calculations
 // by hand if you are running out of flash space. 
@@ -348,6 +580,84 @@ byte sin8_C( byte theta);
 
 uint8_t hasWoken(void);
 
+// Battery voltage in millivolts, or 0 if no reading yet.
+// Measured in the background about once a second from startup if your sketch uses any of these battery
+// functions (if it doesn't, none of this code gets included). Smoothed so a single noisy reading will not jump around.
+// Uses the chip's internal reference which is only accurate to about +/-10%, so best for spotting trends
+// rather than absolute values.
+
+word getBatteryMillivolts(void);
+
+// true if the battery is currently low (below about 2.5V). Has hysteresis so it will not flicker.
+
+bool isBatteryLow(void);
+
+// Did the battery become low since the last time we checked?
+// Handy to dim or sleep a tile that is about to brown out rather than letting it die mid-game.
+
+bool batteryLowDetected(void);
+
+// Rough estimates of how much battery each part of the tile has used since startup, in uAh.
+// Based on a simple model (LED brightness over time, bytes sent over IR, and CPU busy vs idle time)
+// so best for comparing one version of a sketch against another rather than as absolute numbers.
+
+#define ENERGY_LED          0       // Face LEDs
+#define ENERGY_IR           1       // IR transmits
+#define ENERGY_CPU_ACTIVE   2       // CPU running our code and loop()
+#define ENERGY_CPU_IDLE     3       // CPU waiting for the next display refresh
+
+#define ENERGY_SUBSYSTEM_COUNT 4
+
+unsigned long getEnergyUsed( byte subsystem );
+
+// Start all the energy counters back at 0
+
+void resetEnergyUsed(void);
+
+// Print the energy used by each subsystem as `name=value` lines, like...
+//
+//      ServicePortSerial sp;
+//      sp.begin();
+//      printEnergyReport( sp );
+
+class Print;
+
+void printEnergyReport( Print &p );
+
+// Keep game state across sleep.
+//
+// Tell us where your game state lives (usually a struct) and every time the tile goes to sleep we will
+// save a copy of it to flash. If the game later restarts from setup(), you can get it back with restoreCheckpoint()
+// instead of starting over. Like...
+//
+//      setup() {
+//          setCheckpointRegion( &game , sizeof( game ) );
+//          if ( !restoreCheckpoint() ) {
+//              // No saved game, so start fresh
+//          }
+//      }
+//
+// Only pages that changed get written, so this is cheap if the state has not changed since the last sleep.
+// Loading a new game erases the checkpoint, and a tile never restores a checkpoint that came along with a game
+// seeded from a neighbor.
+
+#define CHECKPOINT_MAX_SIZE 244     // Regions longer than this are cut short
+
+void setCheckpointRegion( void *data , byte len );
+
+// Copy the saved checkpoint back into the region. Returns false (and leaves the region alone or scrambled - so
+// initialize it!) if there is no valid checkpoint of the same length.
+
+bool restoreCheckpoint(void);
+
+// Save now rather than waiting for sleep
+
+void saveCheckpoint(void);
+
+// Forget any saved checkpoint, say because the game was won and should start fresh next time
+
+void clearCheckpoint(void);
+
 // Information on how the current game was loaded
 
 #define START_STATE_POWER_UP            0   // Loaded the built-in game (for example, after battery insertion or failed download) 
@@ -391,6 +701,39 @@ void setup(void);
 
 void loop();
 
+// Alternative to loop() that gets handed a snapshot of everything that happened this frame in one
+// compact struct, so you can read it directly instead of calling a bunch of accessor functions each pass.
+// If your sketch defines loopWithState() then it is called instead of loop() and you do not need a loop().
+
+// Button events in FrameState.buttonEvents. These are the events that happened since the last frame.
+// Note that these are not consumed by reading them like buttonPressed() and friends.
+
+#define BUTTON_EVENT_PRESSED          0b00000001
+#define BUTTON_EVENT_LONGPRESSED      0b00000010
+#define BUTTON_EVENT_RELEASED         0b00000100
+#define BUTTON_EVENT_SINGLECLICKED    0b00001000
+#define BUTTON_EVENT_DOUBLECLICKED    0b00010000
+#define BUTTON_EVENT_MULTICLICKED     0b00100000
+#define BUTTON_EVENT_LONGLONGPRESSED  0b01000000
+
+struct FrameState {
+
+    unsigned long millis;                   // Same as millis()
+
+    byte inValues[FACE_COUNT];              // Same as getLastValueReceivedOnFace()
+    byte datagramLengths[FACE_COUNT];       // Same as getDatagramLengthOnFace(). Use getDatagramOnFace() for the data.
+
+    byte expiredFaces;                      // Bit n is 1 if isValueReceivedOnFaceExpired(n)
+    byte stableFaces;                       // Bit n is 1 if isFaceStablyConnected(n)
+
+    byte buttonDown;                        // Same as buttonDown()
+    byte buttonEvents;                      // BUTTON_EVENT_* flags
+    byte clickCount;                        // Same as buttonClickCount()
+
+};
+
+void loopWithState( const FrameState &state );
+
 
 /*
 
@@ -407,5 +750,8 @@ void loop();
 // Get the number of elements in an array.
 #define COUNT_OF(x) ((sizeof(x)/sizeof(x[0])))
 
+// Fast opposite/clockwise/rotate helpers for face numbers and face masks, plus FOREACH_FACE_IN_MASK()
+#include "facemath.h"
+
 
 #endif /* BLINKLIB_H_ */
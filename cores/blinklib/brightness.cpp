@@ -0,0 +1,119 @@
+/*
+ * brightness.cpp
+ *
+ * Global brightness and power budget, applied once per frame when the pixel buffer is committed to the display.
+ *
+ * Sketches set colors at full scale like always. Just before the commit we scale every channel in the pixel
+ * buffer by one common factor, let the BIOS copy the scaled values out to the display, and then put the
+ * sketch's original colors back so it never sees the difference.
+ *
+ * The factor is the global brightness, further reduced if the total of all the channel levels on the tile
+ * would be more than the power budget. LED current is roughly proportional to that total, so capping it caps
+ * the LED load. Scaling everything by the same factor keeps the colors looking right as they dim.
+ *
+ * We use the hardware 8x8 multiply for each channel, so the scale is only 18 multiplies and one divide
+ * (only when the budget actually kicks in). When nothing needs scaling we skip all of it.
+ *
+ */
+
+#include <string.h>         // memcpy()
+
+#include "blinklib.h"
+
+#include "hooks.h"
+
+#include "shared/blinkbios_shared_pixel.h"
+
+static uint8_t globalBrightness = MAX_BRIGHTNESS;
+
+static uint16_t powerBudget = MAX_POWER_BUDGET;
+
+static pixelColor_t brightnessSavedPixels[PIXEL_COUNT];         // The sketch's colors while the scaled ones are being committed
+
+static uint8_t brightnessScaledFlag;                            // Set if we scaled this frame and need to put the originals back
+
+// Scale a 5 bit channel. factor is 1-256, where 256 leaves it unchanged.
+// `factor-1` fits in a byte, so c*factor is an 8x8 `mul` by that plus one more c.
+
+static inline uint8_t scale5( uint8_t c , uint16_t factor ) {
+
+    return ( (uint16_t) ( c * (uint8_t) ( factor - 1 ) ) + c ) >> 8;
+
+}
+
+void brightness_display_begin_hook() {
+
+    uint16_t factor = globalBrightness + 1;         // 1-256
+
+    if ( powerBudget < MAX_POWER_BUDGET ) {
+
+        uint16_t levels = 0;
+
+        FOREACH_FACE(f) {
+
+            pixelColor_t c = blinkbios_pixel_block.pixelBuffer[f];
+
+            levels += c.r + c.g + c.b;
+
+        }
+
+        // Would the total after global brightness still be over budget?
+
+        if ( (uint32_t) levels * factor > (uint32_t) powerBudget * 256 ) {
+
+            factor = ( (uint32_t) powerBudget * 256 ) / levels;         // levels can't be 0 here since it is bigger than the budget
+
+        }
+
+    }
+
+    if ( factor == 256 ) {
+
+        // Fast path - full brightness and under budget
+
+        return;
+
+    }
+
+    pixelColor_t *p = blinkbios_pixel_block.pixelBuffer;
+    pixelColor_t *saved = brightnessSavedPixels;
+
+    FOREACH_FACE(f) {
+
+        *saved++ = *p;
+
+        p->r = scale5( p->r , factor );
+        p->g = scale5( p->g , factor );
+        p->b = scale5( p->b , factor );
+
+        p++;
+
+    }
+
+    brightnessScaledFlag = 1;
+
+}
+
+void brightness_display_end_hook() {
+
+    if ( brightnessScaledFlag ) {
+
+        memcpy( blinkbios_pixel_block.pixelBuffer , brightnessSavedPixels , sizeof( brightnessSavedPixels ) );
+
+        brightnessScaledFlag = 0;
+
+    }
+
+}
+
+void setGlobalBrightness( byte brightness ) {
+
+    globalBrightness = brightness;
+
+}
+
+void setPowerBudget( word levels ) {
+
+    powerBudget = levels;
+
+}
@@ -0,0 +1,217 @@
+/*
+ * checkpoint.cpp
+ *
+ * Save a block of the sketch's RAM to flash on the way to sleep so the game can pick up where it left off.
+ *
+ * The sketch tells us where its state lives with setCheckpointRegion(), usually in setup(). Every time the
+ * tile goes to sleep we copy that region into a reserved, page aligned chunk of our own flash. If the sketch
+ * later restarts from scratch, it can call restoreCheckpoint() to get its state back instead of rebuilding
+ * the whole game with its neighbors.
+ *
+ * The BIOS does not give us a way to run code right before the cold sleep itself, so we save on the way into
+ * warm sleep. Cold sleep only ever happens from inside warm sleep, so the checkpoint is always there in time.
+ *
+ * Flash wears out and each page write stalls us for a few milliseconds, so we build each page image in the
+ * SPM page buffer and compare it against what is already in flash as we go. Pages that did not change are
+ * not written. A game sitting in the same state over many naps does not cost any writes at all.
+ *
+ * The stored image is a small header followed by the data...
+ *
+ *   byte 0     - CHECKPOINT_MAGIC
+ *   byte 1     - length of the data
+ *   byte 2     - checksum of the data
+ *   bytes 3-11 - serial number of the tile that saved it
+ *
+ * The flash area is part of the sketch image, so loading a new game from the IDE wipes the checkpoint. But when
+ * a tile seeds its game to a neighbor, the neighbor gets a copy of the whole image, checkpoint and all. That is why
+ * we keep the serial number - restoreCheckpoint() ignores a checkpoint that some other tile saved.
+ *
+ */
+
+#include <avr/pgmspace.h>   // PROGMEM and pgm_read_byte() for reading back the flash copy
+#include <avr/boot.h>       // boot_page_fill() to load the SPM page buffer
+#include <avr/interrupt.h>  // cli() and sei() around the timing sensitive page buffer fill
+
+#include "blinklib.h"
+
+#include "hooks.h"
+
+#include "shared/blinkbios_shared_functions.h"     // BLINKBIOS_WRITE_FLASH_PAGE_VECTOR
+
+#define CHECKPOINT_MAGIC        0xC5            // Just something unlikely to be in an erased or zeroed page
+
+#define CHECKPOINT_SERIAL_OFFSET    3
+
+#define CHECKPOINT_HEADER_LEN   ( CHECKPOINT_SERIAL_OFFSET + SERIAL_NUMBER_LEN )
+
+#define CHECKPOINT_PAGE_COUNT   2
+
+#define CHECKPOINT_FLASH_SIZE   ( CHECKPOINT_PAGE_COUNT * SPM_PAGESIZE )
+
+#if ( CHECKPOINT_MAX_SIZE + CHECKPOINT_HEADER_LEN ) > CHECKPOINT_FLASH_SIZE
+    #error CHECKPOINT_MAX_SIZE does not fit in the reserved flash pages
+#endif
+
+// Our reserved flash. Page aligned so that writing it never touches any code or data that shares a page.
+// It starts out all zeros, which will never have a valid magic byte.
+
+static const uint8_t checkpointFlash[CHECKPOINT_FLASH_SIZE] PROGMEM __attribute__((aligned(SPM_PAGESIZE))) = { 0 };
+
+static uint8_t *checkpointData;         // The sketch's RAM region. NULL until setCheckpointRegion() is called.
+static uint8_t  checkpointLen;
+
+static uint8_t checkpoint_checksum( const uint8_t *data , uint8_t len ) {
+
+    uint8_t sum = len;
+
+    while (len--) {                     // WCET: 244 (CHECKPOINT_MAX_SIZE)
+
+        sum = ( sum << 1 | sum >> 7 ) ^ *data++;        // Rotate and XOR so that swapped bytes still change the checksum
+
+    }
+
+    return sum;
+
+}
+
+// The byte that should be at offset `o` of the checkpoint image
+
+static uint8_t checkpoint_image_byte( uint8_t header[] , uint16_t o ) {
+
+    if ( o < CHECKPOINT_SERIAL_OFFSET ) {
+
+        return header[o];
+
+    }
+
+    if ( o < CHECKPOINT_HEADER_LEN ) {
+
+        return getSerialNumberByte( o - CHECKPOINT_SERIAL_OFFSET );
+
+    }
+
+    o -= CHECKPOINT_HEADER_LEN;
+
+    if ( o < checkpointLen ) {
+
+        return checkpointData[o];
+
+    }
+
+    return 0;
+
+}
+
+// Write the header and data to flash, skipping any pages that already match
+
+static void checkpoint_write( uint8_t magic ) {
+
+    uint8_t header[CHECKPOINT_SERIAL_OFFSET] = { magic , checkpointLen , checkpoint_checksum( checkpointData , checkpointLen ) };
+
+    const uint8_t *flash = checkpointFlash;
+
+    uint16_t o = 0;
+
+    for( uint8_t p = 0 ; p < CHECKPOINT_PAGE_COUNT ; p++ ) {
+
+        uint8_t dirtyFlag = 0;
+
+        for( uint8_t i = 0 ; i < SPM_PAGESIZE ; i += 2 ) {        // WCET: 64 (SPM_PAGESIZE is 128 on the ATmega168PB)
+
+            uint8_t lo = checkpoint_image_byte( header , o++ );
+            uint8_t hi = checkpoint_image_byte( header , o++ );
+
+            if ( lo != pgm_read_byte( flash++ ) ) dirtyFlag = 1;
+            if ( hi != pgm_read_byte( flash++ ) ) dirtyFlag = 1;
+
+            cli();
+            boot_page_fill( i , lo | ( hi << 8 ) );
+            sei();
+
+        }
+
+        if (dirtyFlag) {
+
+            BLINKBIOS_WRITE_FLASH_PAGE_VECTOR( ( (uint16_t) (uintptr_t) checkpointFlash / SPM_PAGESIZE ) + p );
+
+        }
+
+    }
+
+}
+
+void checkpoint_sleep_hook() {
+
+    if ( checkpointData ) {
+
+        checkpoint_write( CHECKPOINT_MAGIC );
+
+    }
+
+}
+
+void setCheckpointRegion( void *data , byte len ) {
+
+    if ( len > CHECKPOINT_MAX_SIZE ) {
+
+        len = CHECKPOINT_MAX_SIZE;
+
+    }
+
+    checkpointData = (uint8_t *) data;
+    checkpointLen = len;
+
+}
+
+bool restoreCheckpoint() {
+
+    if ( !checkpointData ) {
+        return false;
+    }
+
+    if ( pgm_read_byte( &checkpointFlash[0] ) != CHECKPOINT_MAGIC ) {
+        return false;
+    }
+
+    if ( pgm_read_byte( &checkpointFlash[1] ) != checkpointLen ) {
+
+        // Saved by a different version of the sketch, or from a different region
+
+        return false;
+    }
+
+    for( uint8_t n = 0 ; n < SERIAL_NUMBER_LEN ; n++ ) {
+
+        if ( pgm_read_byte( &checkpointFlash[ CHECKPOINT_SERIAL_OFFSET + n ] ) != getSerialNumberByte( n ) ) {
+
+            // Saved by the tile that seeded us this game, not by us
+
+            return false;
+
+        }
+
+    }
+
+    // We copy straight into the region. If the checksum does not match, the sketch is going to initialize it anyway.
+
+    memcpy_P( checkpointData , &checkpointFlash[CHECKPOINT_HEADER_LEN] , checkpointLen );
+
+    return checkpoint_checksum( checkpointData , checkpointLen ) == pgm_read_byte( &checkpointFlash[2] );
+
+}
+
+void saveCheckpoint() {
+
+    checkpoint_sleep_hook();
+
+}
+
+void clearCheckpoint() {
+
+    if ( checkpointData ) {
+
+        checkpoint_write( 0 );          // Only the header page changes, so this is a single page write
+
+    }
+
+}
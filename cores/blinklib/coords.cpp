@@ -0,0 +1,286 @@
+/*
+ * coords.cpp
+ *
+ * Give every tile in a group an (q,r) position on a hex grid, relative to a root tile.
+ *
+ * We use axial coordinates. The root is at (0,0) and defines which way is "up" - its face 0 points
+ * in global direction 0, and directions go clockwise just like faces do. Going one step in each
+ * direction changes (q,r) by...
+ *
+ *      0 (0,-1)   1 (+1,-1)   2 (+1,0)   3 (0,+1)   4 (-1,+1)   5 (-1,0)
+ *
+ * A tile that knows its position tells each neighbor its (q,r) and the global direction of the face it sent on.
+ * The neighbor is one step that way, and since the two touching faces always point in opposite global
+ * directions, the neighbor also learns which way it is turned. So each hop takes one packet.
+ *
+ * Every tile remembers how many hops it is from the root and which face it learned its position from (its parent).
+ * We only take a position from a neighbor that is closer to the root than we are, and if our parent goes away
+ * we drop our position and tell the faces around us so any tiles that learned from us drop theirs too. Then
+ * everyone picks their position back up from whatever path to the root is left.
+ *
+ * If tiles are ever arranged in a way that could not lie flat on a grid, two neighbors will give us
+ * different answers for where we are. We flag that as a conflict.
+ *
+ * The root is picked by the sketch. If more than one tile says it is root, the one with the lowest tile ID wins.
+ *
+ * All of this is a few bytes of state no matter how many tiles are in the group.
+ *
+ */
+
+#include <avr/pgmspace.h>   // PROGMEM for the direction table
+
+#include "blinklib.h"
+
+#include "hooks.h"
+
+#define COORD_PAYLOAD_LEN       6       // q, r, global direction of sending face, hops, root ID low, root ID high
+
+#define COORD_NO_HOPS       0xff        // Hops value that means "I do not have a position", so drop yours if you got it from me
+#define COORD_MAX_HOPS        60        // Any farther than this is a stale path going around in circles
+
+#define COORD_REFRESH_MS    1000        // How often we resend on every face, to fill in for lost packets
+
+// Change in q and r for one step in each global direction
+
+static const int8_t coordDirQ[FACE_COUNT] PROGMEM = {  0 , +1 , +1 ,  0 , -1 , -1 };
+static const int8_t coordDirR[FACE_COUNT] PROGMEM = { -1 , -1 ,  0 , +1 , +1 ,  0 };
+
+static int8_t coordQ;
+static int8_t coordR;
+static uint8_t coordOrientation;        // Global direction our face 0 points
+static uint8_t coordHops = COORD_NO_HOPS;
+static uint8_t coordParentFace;         // Face we learned our position from
+static word coordRootId = NO_TILE_ID;
+
+static uint8_t coordRootFlag;           // Sketch made us the root
+static uint8_t coordConflictFlag;
+
+static uint8_t coordSendBitflags;       // A 1 means we have something new to tell the neighbor on this face
+static uint8_t coordLastExpiredFaces;   // So we can see links coming up
+
+static unsigned long coordRefreshTime;
+
+// Tell all our neighbors what we know
+
+static void coord_send_all() {
+
+    coordSendBitflags = ALL_FACES_MASK;
+
+}
+
+static void coord_drop() {
+
+    coordHops = COORD_NO_HOPS;
+    coordRootId = NO_TILE_ID;
+    coordConflictFlag = 0;
+
+    coord_send_all();
+
+}
+
+void coord_loop_hook() {
+
+    uint8_t expired = blinklib_frameState.expiredFaces;
+
+    // Tell any newly connected neighbors right away
+
+    coordSendBitflags |= coordLastExpiredFaces & ~expired;
+
+    coordLastExpiredFaces = expired;
+
+    if ( coordHops != COORD_NO_HOPS && !coordRootFlag && TBI( expired , coordParentFace ) ) {
+
+        // Lost our path to the root
+
+        coord_drop();
+
+    }
+
+    if ( coordRefreshTime <= millis() ) {
+
+        coordRefreshTime = millis() + COORD_REFRESH_MS;
+
+        coord_send_all();
+
+    }
+
+}
+
+uint8_t coord_tx_hook( uint8_t face , uint8_t *payload ) {
+
+    if ( !TBI( coordSendBitflags , face ) ) {
+
+        return 0;
+
+    }
+
+    CBI( coordSendBitflags , face );
+
+    payload[0] = coordQ;
+    payload[1] = coordR;
+    payload[2] = rotateFace( face , coordOrientation );
+    payload[3] = coordHops;
+    payload[4] = coordRootId & 0xff;
+    payload[5] = coordRootId >> 8;
+
+    return COORD_PAYLOAD_LEN;
+
+}
+
+void coord_rx_hook( uint8_t face , const uint8_t *payload , uint8_t len ) {
+
+    if ( len < COORD_PAYLOAD_LEN ) {
+        return;
+    }
+
+    uint8_t theirHops = payload[3];
+
+    if ( theirHops == COORD_NO_HOPS ) {
+
+        // They do not know where they are. If that is where we got our position, it is no good anymore.
+
+        if ( coordHops != COORD_NO_HOPS ) {
+
+            if ( !coordRootFlag && face == coordParentFace ) {
+
+                coord_drop();
+
+            } else {
+
+                // We still know where we are, so help them find out too
+
+                SBI( coordSendBitflags , face );
+
+            }
+
+        }
+
+        return;
+
+    }
+
+    word theirRootId = payload[4] | ( payload[5] << 8 );
+
+    uint8_t theirDir = payload[2];
+
+    if ( theirDir >= FACE_COUNT || theirHops >= COORD_MAX_HOPS ) {
+        return;
+    }
+
+    // Work out where they say we are
+
+    int8_t q = payload[0] + (int8_t) pgm_read_byte( &coordDirQ[theirDir] );
+    int8_t r = payload[1] + (int8_t) pgm_read_byte( &coordDirR[theirDir] );
+
+    // Our face points the opposite way from theirs, so that tells us how we are turned
+
+    uint8_t orientation = faceStepsClockwise( face , oppositeFace( theirDir ) );
+
+    uint8_t hops = theirHops + 1;
+
+    bool sameRoot = ( theirRootId == coordRootId );
+
+    if ( coordHops != COORD_NO_HOPS && sameRoot ) {
+
+        if ( q != coordQ || r != coordR || orientation != coordOrientation ) {
+
+            // Two paths to the same root disagree about where we are
+
+            coordConflictFlag = 1;
+
+        }
+
+    }
+
+    if ( coordRootFlag && theirRootId >= coordRootId ) {
+
+        // We are the root and nobody with a lower ID is trying to be
+
+        return;
+
+    }
+
+    // Take the position if we do not have one, if it comes from a lower root, if it is a shorter path
+    // to our root, or if it is a fresh word from our parent
+
+    if ( coordHops == COORD_NO_HOPS || theirRootId < coordRootId || ( sameRoot && ( hops < coordHops || face == coordParentFace ) ) ) {
+
+        if ( !sameRoot ) {
+
+            coordConflictFlag = 0;      // New root, so start fresh
+            coordRootFlag = 0;          // If we were root, someone with a lower ID has taken over
+
+        }
+
+        if ( !sameRoot || q != coordQ || r != coordR || orientation != coordOrientation || hops != coordHops ) {
+
+            coordQ = q;
+            coordR = r;
+            coordOrientation = orientation;
+            coordHops = hops;
+            coordRootId = theirRootId;
+
+            coord_send_all();
+
+        }
+
+        coordParentFace = face;
+
+    }
+
+}
+
+void setCoordinateRoot( bool rootFlag ) {
+
+    if ( rootFlag ) {
+
+        coordRootFlag = 1;
+
+        coordQ = 0;
+        coordR = 0;
+        coordOrientation = 0;
+        coordHops = 0;
+        coordRootId = getTileId();
+        coordConflictFlag = 0;
+
+        coord_send_all();
+
+    } else if ( coordRootFlag ) {
+
+        coordRootFlag = 0;
+
+        coord_drop();
+
+    }
+
+}
+
+bool hasCoordinates() {
+
+    return coordHops != COORD_NO_HOPS;
+
+}
+
+int8_t getCoordinateQ() {
+
+    return coordQ;
+
+}
+
+int8_t getCoordinateR() {
+
+    return coordR;
+
+}
+
+byte getCoordinateOrientation() {
+
+    return coordOrientation;
+
+}
+
+bool isCoordinateConflict() {
+
+    return coordConflictFlag;
+
+}
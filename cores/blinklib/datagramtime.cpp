@@ -0,0 +1,27 @@
+/*
+ * datagramtime.cpp
+ *
+ * When each received datagram was picked up from the BIOS, for getDatagramTimeOnFace().
+ *
+ * This is its own file so that only sketches that ask for the times pay the 4 bytes of RAM per face
+ * to keep them.
+ *
+ */
+
+#include "blinklib.h"
+
+#include "hooks.h"
+
+static unsigned long datagramTime[FACE_COUNT];      // micros() when RX_IRFaces() picked up each received datagram
+
+void datagram_rx_hook( uint8_t face ) {
+
+    datagramTime[face] = micros();
+
+}
+
+unsigned long getDatagramTimeOnFace( uint8_t face ) {
+
+    return datagramTime[face];
+
+}
@@ -0,0 +1,191 @@
+/*
+ * energy.cpp
+ *
+ * Rough energy accounting so you can see which parts of a game are draining the battery.
+ *
+ * We do not have a way to actually measure current, so instead we keep a simple model and integrate it over time...
+ *
+ *  LEDs        - The brightness levels committed to the display each frame times how long that frame was shown.
+ *  IR          - A fixed charge for every byte we send.
+ *  CPU active  - Time from when the display commit returns until we start the next one (our code plus the sketch's loop()).
+ *  CPU idle    - Time spent waiting inside the display commit for the next vertical blanking interval.
+ *
+ * The model constants below are ballpark numbers. They are good for comparing one version of
+ * a sketch to another, not for predicting exactly how long a battery will last. Tune them against a meter if you need better.
+ *
+ * Charge is accumulated in units of uA*8us (8us is the finest tick the BIOS gives us) and then
+ * carried into whole uAh so the totals can run for a very long time without overflowing.
+ *
+ */
+
+#include <avr/interrupt.h>  // cli() and sei() so we can get snapshots of multibyte variables
+
+#include <string.h>         // memset()
+
+#include "blinklib.h"
+
+#include "Print.h"
+
+#include "hooks.h"
+
+#include "shared/blinkbios_shared_millis.h"
+#include "shared/blinkbios_shared_pixel.h"
+
+#define ENERGY_LED_UA_PER_LEVEL         45      // Average current for one brightness level (out of 31) on one color of one face, after multiplexing
+#define ENERGY_IR_UAX8US_PER_BYTE     4000      // Charge to send one IR byte, in uA*8us (about 10mA for about 3.2ms of LED on-time per 100 bytes)
+#define ENERGY_CPU_ACTIVE_UA          3000      // Running flat out at 8Mhz
+#define ENERGY_CPU_IDLE_UA            1000      // Waiting for vertical blanking with the display ISR still ticking
+
+#define ENERGY_UAX8US_PER_UAH   ( 3600UL * 1000UL * 1000UL / 8 )      // How many uA*8us in 1 uAh
+
+#define STEPS_8US_PER_MS        125                                 // blinkbios_millis_block.step_8us goes 0-124
+
+#define ENERGY_MAX_INTERVAL_8US ( 1000UL * STEPS_8US_PER_MS )       // Longest interval we will integrate in one go. Keeps the multiplies below from
+                                                                    // overflowing after something like the seed mode spin holds us up.
+
+struct energy_counter_t {
+
+    uint32_t uah;           // Whole uAh
+    uint32_t fraction;      // Leftover in uA*8us, always less than ENERGY_UAX8US_PER_UAH
+
+};
+
+static energy_counter_t energyCounters[ENERGY_SUBSYSTEM_COUNT];
+
+static uint32_t energyDisplayBeginTime;     // When we started the current display commit, in 8us ticks
+static uint32_t energyDisplayEndTime;       // When the last display commit finished, in 8us ticks
+
+static uint16_t energyShownLevels;          // Sum of the brightness levels on screen since the last commit
+static uint16_t energyNextLevels;           // Sum of the brightness levels in the commit that is happening now
+
+// Current time in 8us ticks. Wraps every ~9.5 hours, but we only ever look at differences.
+
+static uint32_t energy_now_8us() {
+
+    cli();
+    millis_t ms = blinkbios_millis_block.millis;
+    uint8_t steps = blinkbios_millis_block.step_8us;
+    sei();
+
+    return ( ms * STEPS_8US_PER_MS ) + steps;
+
+}
+
+// 8us ticks between two times, clamped to ENERGY_MAX_INTERVAL_8US
+
+static uint32_t energy_interval( uint32_t from , uint32_t to ) {
+
+    uint32_t d = to - from;
+
+    if ( d > ENERGY_MAX_INTERVAL_8US ) {
+
+        d = ENERGY_MAX_INTERVAL_8US;
+
+    }
+
+    return d;
+
+}
+
+static void energy_add( uint8_t subsystem , uint32_t uax8us ) {
+
+    energy_counter_t *c = &energyCounters[subsystem];
+
+    c->fraction += uax8us;
+
+    while ( c->fraction >= ENERGY_UAX8US_PER_UAH ) {       // WCET: 9 (a uint32_t holds at most 9 whole uAh)
+
+        c->fraction -= ENERGY_UAX8US_PER_UAH;
+        c->uah++;
+
+    }
+
+}
+
+void energy_display_begin_hook() {
+
+    uint32_t t = energy_now_8us();
+
+    // Everything since the last display commit finished was us or the sketch running
+
+    energy_add( ENERGY_CPU_ACTIVE , energy_interval( energyDisplayEndTime , t ) * ENERGY_CPU_ACTIVE_UA );
+
+    energyDisplayBeginTime = t;
+
+    // The buffer holds the pixels that are about to be committed. Once the commit returns it
+    // holds them still, so add them up now and charge for them at the end of the next commit.
+
+    uint16_t levels = 0;
+
+    FOREACH_FACE(f) {
+
+        pixelColor_t c = blinkbios_pixel_block.pixelBuffer[f];
+
+        levels += c.r + c.g + c.b;
+
+    }
+
+    energyNextLevels = levels;
+
+}
+
+void energy_display_end_hook() {
+
+    uint32_t t = energy_now_8us();
+
+    energy_add( ENERGY_CPU_IDLE , energy_interval( energyDisplayBeginTime , t ) * ENERGY_CPU_IDLE_UA );
+
+    // The pixels from the last commit were on screen until this one took over
+
+    energy_add( ENERGY_LED , energy_interval( energyDisplayEndTime , t ) * ( (uint32_t) energyShownLevels * ENERGY_LED_UA_PER_LEVEL ) );
+
+    energyShownLevels = energyNextLevels;
+
+    energyDisplayEndTime = t;
+
+}
+
+void energy_ir_tx_hook( uint8_t len ) {
+
+    energy_add( ENERGY_IR , (uint32_t) len * ENERGY_IR_UAX8US_PER_BYTE );
+
+}
+
+unsigned long getEnergyUsed( byte subsystem ) {
+
+    return energyCounters[subsystem].uah;
+
+}
+
+void resetEnergyUsed() {
+
+    memset( energyCounters , 0 , sizeof( energyCounters ) );
+
+}
+
+// Send the totals out as `name=value` lines so they are easy to read and easy to parse
+
+static const char energyNames[ENERGY_SUBSYSTEM_COUNT][11] PROGMEM = {
+    "led_uAh=",
+    "ir_uAh=",
+    "cpu_uAh=",
+    "idle_uAh=",
+};
+
+void printEnergyReport( Print &p ) {
+
+    unsigned long total = 0;
+
+    for( uint8_t s = 0; s < ENERGY_SUBSYSTEM_COUNT ; s++ ) {
+
+        p.print( FPSTR( energyNames[s] ) );
+        p.println( energyCounters[s].uah );
+
+        total += energyCounters[s].uah;
+
+    }
+
+    p.print( F("total_uAh=") );
+    p.println( total );
+
+}
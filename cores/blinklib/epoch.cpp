@@ -0,0 +1,314 @@
+/*
+ * epoch.cpp
+ *
+ * Notice when two groups of tiles that have been apart are pushed together, so the sketch can sort out
+ * its game state once instead of constantly resending everything just in case.
+ *
+ * Every connected group shares an epoch, which is the tile ID of its leader plus a count. The leader sends
+ * a heartbeat once a second and everyone passes it along. If a group gets split, the part without the leader
+ * stops hearing the heartbeat, so after a few seconds each of those tiles makes a new epoch with itself as leader.
+ * Since they all do this at about the same time, they settle on the one with the lowest leader ID.
+ *
+ * Each tile is in one of three states, which it sends along with its epoch...
+ *
+ *  FORMING - We just started up or just made a new epoch. We quietly take on any other epoch we hear about.
+ *  STABLE  - Things have been quiet for a while. Any different epoch we hear from another stable tile must
+ *            be from a group that grew up apart from ours, so that is a merge.
+ *  MERGING - We just merged. Our neighbors take on our epoch and also count it as a merge, so the news spreads
+ *            through both groups and every tile gets told exactly once.
+ *
+ * When two stable tiles find out they are in different epochs, they both work out the same new epoch from
+ * the two old ones without having to talk about it. The group whose leader had the lower tile ID wins and
+ * its leader leads the new epoch.
+ *
+ */
+
+#include "blinklib.h"
+
+#include "hooks.h"
+
+#define EPOCH_PAYLOAD_LEN       5       // Leader ID low, leader ID high, count, heartbeat, state
+
+#define EPOCH_STATE_FORMING     0
+#define EPOCH_STATE_STABLE      1
+#define EPOCH_STATE_MERGING     2
+
+#define EPOCH_SETTLE_MS      5000       // How long we stay FORMING or MERGING after the last change. Longer than EPOCH_LOST_MS so everyone cut off from the leader has noticed by the time we are STABLE.
+#define EPOCH_BEAT_MS        1000       // How often the leader sends a heartbeat
+#define EPOCH_LOST_MS        4000       // No heartbeat in this long means we got split from the leader
+#define EPOCH_REFRESH_MS     1000       // How often we resend on every face, to fill in for lost packets
+
+static word epochLeader = NO_TILE_ID;   // NO_TILE_ID until we start
+static uint8_t epochCount;
+static uint8_t epochBeat;
+static uint8_t epochState;
+
+static unsigned long epochSettleTime;   // When FORMING or MERGING is over
+static unsigned long epochNewsTime;     // Last time we heard a new heartbeat
+static unsigned long epochBeatTime;     // When the leader sends the next heartbeat
+static unsigned long epochRefreshTime;
+
+static uint8_t epochSendBitflags;       // A 1 means we have something new to tell the neighbor on this face
+static uint8_t epochLastExpiredFaces;   // So we can see links coming up
+
+static void (*epochMergeHandler)( bool won );
+
+static uint8_t epochMergePendingFlag;   // Merge happened, call the handler next pass
+static uint8_t epochMergeWonFlag;
+
+// Tell all our neighbors what we know
+
+static void epoch_send_all() {
+
+    epochSendBitflags = ALL_FACES_MASK;
+
+}
+
+static void epoch_set( word leader , uint8_t count , uint8_t beat , uint8_t state ) {
+
+    epochLeader = leader;
+    epochCount = count;
+    epochBeat = beat;
+    epochState = state;
+
+    epochSettleTime = millis() + EPOCH_SETTLE_MS;
+
+    epoch_send_all();
+
+}
+
+// Start over with a new epoch led by us
+
+static void epoch_lead( uint8_t count ) {
+
+    epoch_set( getTileId() , count , 0 , EPOCH_STATE_FORMING );
+
+    epochNewsTime = millis();
+
+}
+
+// A merge just changed our epoch. We won if our leader is still the leader.
+
+static void epoch_merged( word leader , uint8_t count , uint8_t beat ) {
+
+    epochMergeWonFlag = ( leader == epochLeader );
+    epochMergePendingFlag = 1;
+
+    epoch_set( leader , count , beat , EPOCH_STATE_MERGING );
+
+    epochNewsTime = millis();       // Give the news time to get to the new leader
+
+}
+
+// Which epoch wins a merge? Lower leader ID, then higher count.
+
+static bool epoch_wins( word leaderA , uint8_t countA , word leaderB , uint8_t countB ) {
+
+    if ( leaderA != leaderB ) {
+
+        return leaderA < leaderB;
+
+    }
+
+    return (int8_t) ( countA - countB ) > 0;
+
+}
+
+// While forming, which epoch do we take? A new epoch always has a higher count than the one that lost its leader,
+// so going by count first means a dead epoch can not win out over the new ones. Then lower leader ID.
+
+static bool epoch_newer( word leaderA , uint8_t countA , word leaderB , uint8_t countB ) {
+
+    if ( countA != countB ) {
+
+        return (int8_t) ( countA - countB ) > 0;
+
+    }
+
+    return leaderA < leaderB;
+
+}
+
+void epoch_loop_hook() {
+
+    if ( epochLeader == NO_TILE_ID ) {
+
+        // Just started, so we are a group of one until we hear otherwise
+
+        epoch_lead( 0 );
+
+    }
+
+    uint8_t expired = blinklib_frameState.expiredFaces;
+
+    // Tell any newly connected neighbors right away
+
+    epochSendBitflags |= epochLastExpiredFaces & ~expired;
+
+    epochLastExpiredFaces = expired;
+
+    if ( epochState != EPOCH_STATE_STABLE && epochSettleTime <= millis() ) {
+
+        epochState = EPOCH_STATE_STABLE;
+
+        epoch_send_all();
+
+    }
+
+    if ( epochLeader == getTileId() ) {
+
+        if ( epochBeatTime <= millis() ) {
+
+            epochBeatTime = millis() + EPOCH_BEAT_MS;
+
+            epochBeat++;
+            epochNewsTime = millis();
+
+            epoch_send_all();
+
+        }
+
+    } else if ( epochNewsTime + EPOCH_LOST_MS <= millis() ) {
+
+        // Cut off from the leader. Start a new epoch led by us.
+
+        epoch_lead( epochCount + 1 );
+
+    }
+
+    if ( epochRefreshTime <= millis() ) {
+
+        epochRefreshTime = millis() + EPOCH_REFRESH_MS;
+
+        epoch_send_all();
+
+    }
+
+    if ( epochMergePendingFlag ) {
+
+        epochMergePendingFlag = 0;
+
+        if ( epochMergeHandler ) {
+
+            epochMergeHandler( epochMergeWonFlag );
+
+        }
+
+    }
+
+}
+
+uint8_t epoch_tx_hook( uint8_t face , uint8_t *payload ) {
+
+    if ( !TBI( epochSendBitflags , face ) ) {
+
+        return 0;
+
+    }
+
+    CBI( epochSendBitflags , face );
+
+    payload[0] = epochLeader & 0xff;
+    payload[1] = epochLeader >> 8;
+    payload[2] = epochCount;
+    payload[3] = epochBeat;
+    payload[4] = epochState;
+
+    return EPOCH_PAYLOAD_LEN;
+
+}
+
+void epoch_rx_hook( uint8_t face , const uint8_t *payload , uint8_t len ) {
+
+    if ( len < EPOCH_PAYLOAD_LEN || epochLeader == NO_TILE_ID ) {
+        return;
+    }
+
+    word leader = payload[0] | ( payload[1] << 8 );
+    uint8_t count = payload[2];
+    uint8_t beat = payload[3];
+    uint8_t theirState = payload[4];
+
+    if ( leader == epochLeader && count == epochCount ) {
+
+        // Same epoch. Pass along any new heartbeat.
+
+        if ( (int8_t) ( beat - epochBeat ) > 0 ) {
+
+            epochBeat = beat;
+            epochNewsTime = millis();
+
+            epoch_send_all();
+
+        }
+
+        return;
+
+    }
+
+    if ( epochState == EPOCH_STATE_STABLE ) {
+
+        if ( theirState == EPOCH_STATE_STABLE ) {
+
+            // Two groups that grew up apart. We both work out the same new epoch from the two old ones.
+
+            uint8_t newCount = ( (int8_t) ( count - epochCount ) > 0 ? count : epochCount ) + 1;
+
+            epoch_merged( epoch_wins( leader , count , epochLeader , epochCount ) ? leader : epochLeader , newCount , 0 );
+
+        } else if ( theirState == EPOCH_STATE_MERGING ) {
+
+            // News of a merge
+
+            epoch_merged( leader , count , beat );
+
+        } else {
+
+            // They are new here and will take ours
+
+            SBI( epochSendBitflags , face );
+
+        }
+
+    } else if ( epochState == EPOCH_STATE_FORMING ) {
+
+        if ( theirState != EPOCH_STATE_FORMING || epoch_newer( leader , count , epochLeader , epochCount ) ) {
+
+            // We do not count this as news from the leader. If their epoch has lost its leader too,
+            // we want to notice as soon as they do and not keep it going between us.
+
+            epoch_set( leader , count , beat , EPOCH_STATE_FORMING );
+
+        }
+
+    } else {
+
+        // We are merging. If someone else is too, settle on the better one. Otherwise they will take ours.
+
+        if ( theirState == EPOCH_STATE_MERGING && epoch_wins( leader , count , epochLeader , epochCount ) ) {
+
+            epoch_set( leader , count , beat , EPOCH_STATE_MERGING );
+
+            epochNewsTime = millis();
+
+        } else {
+
+            SBI( epochSendBitflags , face );
+
+        }
+
+    }
+
+}
+
+void setClusterMergeHandler( void (*handler)( bool won ) ) {
+
+    epochMergeHandler = handler;
+
+}
+
+word getClusterLeader() {
+
+    return epochLeader == NO_TILE_ID ? getTileId() : epochLeader;
+
+}
@@ -0,0 +1,93 @@
+/*
+ * facemath.h
+ *
+ * Helpers for doing math on face numbers and 6-bit face masks.
+ *
+ * Sketches do this stuff all the time in their innermost loops, and the obvious way to write it
+ * with `%` turns into a call to the software divide routine on the AVR. These do the same
+ * thing with a compare and an add, and they are all `constexpr` so they compile away
+ * completely when the face is a constant.
+ *
+ * We thought about PROGMEM lookup tables for these, but an `lpm` plus the pointer math to
+ * set it up is slower than a compare-and-add that lives entirely in registers.
+ *
+ * Faces are numbered 0-5 going clockwise around the tile. In a face mask, bit 0 is face 0.
+ *
+ * This is pulled in automatically by blinklib.h.
+ *
+ */
+
+#ifndef FACEMATH_H_
+#define FACEMATH_H_
+
+#include "ArduinoTypes.h"
+
+#ifndef FACE_COUNT
+    #error Include blinklib.h rather than including facemath.h directly
+#endif
+
+// The face directly across the tile. Two tiles that are touching always touch on opposite faces
+// when they are lined up the same way.
+
+inline constexpr byte oppositeFace( byte face ) {
+    return face < (FACE_COUNT/2) ? face + (FACE_COUNT/2) : face - (FACE_COUNT/2);
+}
+
+// The next face clockwise from this one
+
+inline constexpr byte clockwiseFace( byte face ) {
+    return face == (FACE_COUNT-1) ? 0 : face + 1;
+}
+
+// The next face counter-clockwise from this one
+
+inline constexpr byte counterClockwiseFace( byte face ) {
+    return face == 0 ? (FACE_COUNT-1) : face - 1;
+}
+
+// The face n steps clockwise from this one. n must be 0-5.
+
+inline constexpr byte rotateFace( byte face , byte n ) {
+    return face + n >= FACE_COUNT ? face + n - FACE_COUNT : face + n;
+}
+
+// How many steps clockwise you need to go to get from face a to face b. Returns 0-5.
+
+inline constexpr byte faceStepsClockwise( byte a , byte b ) {
+    return b >= a ? b - a : b + FACE_COUNT - a;
+}
+
+/* --- Face masks */
+
+#define FACE_MASK(face)     ( 1 << (face) )                 // Mask with just the bit for this face set
+#define ALL_FACES_MASK      ( ( 1 << FACE_COUNT ) - 1 )     // Mask with every face set
+
+// Rotate a face mask one step clockwise, so the bit for face 5 wraps around to face 0
+
+inline constexpr byte rotateFaceMaskClockwise( byte mask ) {
+    return ( ( mask << 1 ) | ( mask >> (FACE_COUNT-1) ) ) & ALL_FACES_MASK;
+}
+
+// Rotate a face mask n steps clockwise. n must be 0-5.
+// Note that AVR has no barrel shifter so this is one step per n, but gcc turns the recursion into a tight loop.
+
+inline constexpr byte rotateFaceMask( byte mask , byte n ) {
+    return n ? rotateFaceMask( rotateFaceMaskClockwise( mask ) , n - 1 ) : mask;
+}
+
+// Number of faces set in a face mask
+
+inline constexpr byte countFacesInMask( byte mask ) {
+    return mask ? ( mask & 1 ) + countFacesInMask( mask >> 1 ) : 0;
+}
+
+// Loop over only the faces that are set in mask, like...
+//
+//      FOREACH_FACE_IN_MASK( f , state.stableFaces ) { ... }
+//
+// We shift the mask down as we go so the loop stops as soon as there are no more faces left.
+// The odd looking `if {} else` is so an `else` after the loop body can not get captured by our `if`.
+
+#define FOREACH_FACE_IN_MASK(x,mask) for( uint8_t x = 0 , x##_mask = (mask) ; x##_mask ; ++ x , x##_mask >>= 1 ) if ( !( x##_mask & 1 ) ) {} else
+
+#endif /* FACEMATH_H_ */
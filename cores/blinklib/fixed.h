@@ -0,0 +1,212 @@
+/*
+ * fixed.h
+ *
+ * Fixed point numbers for when you want fractions but not floats.
+ *
+ * The AVR has no floating point hardware, so every float operation is a call into a big software
+ * library. A single float multiply takes hundreds of cycles and just using floats at all pulls in a
+ * couple KB of flash, which is a big chunk of what we have. A fixed point number is really just an
+ * integer where we agree that the bottom bits are the fraction, so the math is plain integer math.
+ *
+ * Two sizes...
+ *
+ *  fix8_8      - Q8.8 in 2 bytes. Range -128 to +127.996 in steps of 1/256. Multiply uses the hardware multiplier and is very fast.
+ *  fix16_16    - Q16.16 in 4 bytes. Range -32768 to +32767.99998 in steps of 1/65536. Add and subtract are just 32 bit
+ *                integer ops. Multiply and divide need 64 bit intermediates, and a 64 bit divide is slow on the AVR, so a
+ *                fix16_16 divide is not necessarily any faster than a float one. Run Examples05/FixedPointBenchmark on a
+ *                tile to see what each costs.
+ *
+ * All the math saturates - if a result would not fit it sticks at the largest (or smallest) value instead of
+ * wrapping around. So a ball that gets too fast just stays really fast rather than suddenly going backwards.
+ * Divide by zero also saturates.
+ *
+ * Constants made from literals like `fix8_8( 0.25 )` are computed at compile time, so they do not pull in any float code.
+ * Just don't make them from float variables at run time.
+ *
+ * You can print them like any number with `sp.print( x )` or `sp.print( x , 3 )` for 3 decimal places.
+ *
+ * Example...
+ *
+ *      #include "fixed.h"
+ *
+ *      fix8_8 speed = fix8_8( 1.5 );
+ *      fix8_8 friction = fix8_8( 0.95 );
+ *
+ *      speed *= friction;
+ *      byte b = speed.toInt();
+ *
+ */
+
+#ifndef FIXED_H_
+#define FIXED_H_
+
+#include <stdint.h>
+
+// T is the storage type, W is a type twice as wide to hold intermediate results, F is number of fraction bits
+
+template< typename T , typename W , uint8_t F >
+class Fixed {
+
+    // Largest and smallest raw values, and the raw value of 1.
+    // These are enums rather than static members so they never need storage.
+
+    enum : W {
+        MAX_RAW = (T) ( ( (W) 1 << ( sizeof(T) * 8 - 1 ) ) - 1 ),
+        MIN_RAW = - MAX_RAW - 1,
+        ONE_RAW = (W) 1 << F,
+    };
+
+    // Clamp a wide intermediate result into range
+
+    static constexpr T saturate( W w ) {
+        return w > MAX_RAW ? (T) MAX_RAW : ( w < MIN_RAW ? (T) MIN_RAW : (T) w );
+    }
+
+    // Round a double to the nearest raw value. Only meant for compile time constants.
+
+    static constexpr T fromDouble( double d ) {
+        return d * ONE_RAW >= MAX_RAW ? (T) MAX_RAW : ( d * ONE_RAW <= MIN_RAW ? (T) MIN_RAW : (T) ( d * ONE_RAW + ( d < 0 ? -0.5 : 0.5 ) ) );
+    }
+
+    struct raw_tag {};
+
+    constexpr Fixed( T r , raw_tag ) : raw( r ) {}
+
+  public:
+
+    // The underlying integer. The real value is raw / 2^F.
+
+    T raw;
+
+    enum : uint8_t { FRACTION_BITS = F };
+
+    constexpr Fixed() : raw( 0 ) {}
+
+    constexpr Fixed( int i ) : raw( saturate( (W) i * ONE_RAW ) ) {}
+
+    constexpr Fixed( double d ) : raw( fromDouble( d ) ) {}
+
+    // Make from the underlying integer, like `fix8_8::fromRaw( 128 )` for 0.5
+
+    static constexpr Fixed fromRaw( T r ) {
+        return Fixed( r , raw_tag() );
+    }
+
+    // Make from a ratio of integers without any floats, like `fix8_8::fromRatio( 1 , 3 )`.
+    // Divides in double width, so `fix8_8::fromRatio( 200 , 400 )` is 0.5 even though 200 and 400 are out of range.
+
+    static Fixed fromRatio( int num , int den ) {
+
+        if ( den == 0 ) {
+            return fromRaw( num < 0 ? MIN_RAW : MAX_RAW );
+        }
+
+        return fromRaw( saturate( ( (W) num * ONE_RAW ) / den ) );
+    }
+
+    // Whole number part, rounded down toward negative infinity like floor()
+
+    constexpr int toInt() const {
+        return raw >> F;
+    }
+
+    // Whole number part, rounded to nearest
+
+    constexpr int roundToInt() const {
+        return ( (W) raw + ( ONE_RAW >> 1 ) ) >> F;
+    }
+
+    // Just the fraction part as 0-255, which is handy for dim() and friends
+
+    constexpr uint8_t fractionByte() const {
+        return (uint8_t) ( (W) raw >> ( F - 8 ) );
+    }
+
+    // Only if you really need it - this pulls in the float library
+
+    float toFloat() const {
+        return (float) raw / ONE_RAW;
+    }
+
+    // Arithmetic
+
+    Fixed operator+( Fixed b ) const {
+        return fromRaw( saturate( (W) raw + b.raw ) );
+    }
+
+    Fixed operator-( Fixed b ) const {
+        return fromRaw( saturate( (W) raw - b.raw ) );
+    }
+
+    Fixed operator-() const {
+        return fromRaw( saturate( - (W) raw ) );
+    }
+
+    // Multiply in double width so nothing is lost, then round back down
+
+    Fixed operator*( Fixed b ) const {
+        return fromRaw( saturate( ( (W) raw * b.raw + ( ONE_RAW >> 1 ) ) >> F ) );
+    }
+
+    Fixed operator/( Fixed b ) const {
+
+        if ( b.raw == 0 ) {
+            return fromRaw( raw < 0 ? MIN_RAW : MAX_RAW );
+        }
+
+        return fromRaw( saturate( ( (W) raw * ONE_RAW ) / b.raw ) );
+    }
+
+    // Multiply or divide by a plain integer. Cheaper than converting the integer to fixed first.
+
+    Fixed operator*( int i ) const {
+        return fromRaw( saturate( (W) raw * i ) );
+    }
+
+    Fixed operator/( int i ) const {
+        return i ? fromRaw( saturate( (W) raw / i ) ) : fromRaw( raw < 0 ? MIN_RAW : MAX_RAW );
+    }
+
+    // Without these, `x * 1.5` would quietly pick the int version above and multiply by 1.
+    // With a literal the conversion happens at compile time.
+
+    Fixed operator*( double d ) const {
+        return *this * Fixed( d );
+    }
+
+    Fixed operator/( double d ) const {
+        return *this / Fixed( d );
+    }
+
+    Fixed &operator+=( Fixed b ) { return *this = *this + b; }
+    Fixed &operator-=( Fixed b ) { return *this = *this - b; }
+    Fixed &operator*=( Fixed b ) { return *this = *this * b; }
+    Fixed &operator/=( Fixed b ) { return *this = *this / b; }
+    Fixed &operator*=( int i )   { return *this = *this * i; }
+    Fixed &operator/=( int i )   { return *this = *this / i; }
+
+    // Comparisons
+
+    constexpr bool operator==( Fixed b ) const { return raw == b.raw; }
+    constexpr bool operator!=( Fixed b ) const { return raw != b.raw; }
+    constexpr bool operator< ( Fixed b ) const { return raw <  b.raw; }
+    constexpr bool operator> ( Fixed b ) const { return raw >  b.raw; }
+    constexpr bool operator<=( Fixed b ) const { return raw <= b.raw; }
+    constexpr bool operator>=( Fixed b ) const { return raw >= b.raw; }
+
+    static constexpr Fixed maxValue() { return fromRaw( MAX_RAW ); }
+    static constexpr Fixed minValue() { return fromRaw( MIN_RAW ); }
+
+};
+
+// So `2 * x` works as well as `x * 2`
+
+template< typename T , typename W , uint8_t F >
+inline Fixed<T,W,F> operator*( int i , Fixed<T,W,F> f ) {
+    return f * i;
+}
+
+typedef Fixed< int16_t , int32_t ,  8 > fix8_8;
+typedef Fixed< int32_t , int64_t , 16 > fix16_16;
+
+#endif /* FIXED_H_ */
@@ -0,0 +1,138 @@
+/*
+ * hooks.h
+ *
+ * Hook points in run() for optional services that live in their own files.
+ *
+ * Each hook has an empty `weak` default in blinklib.cpp. The real version lives in the service's
+ * own .cpp file, and the linker only pulls that file in from the core archive if the sketch actually
+ * calls one of the service's API functions. When that happens the strong version replaces the
+ * empty default. When it doesn't, LTO inlines the empty default and the hook costs nothing.
+ *
+ * So a sketch that never asks for the battery voltage never pays for sampling it.
+ *
+ */
+
+#ifndef HOOKS_H_
+#define HOOKS_H_
+
+#include "blinklib.h"
+
+// Bit helpers shared by blinklib.cpp and the services
+
+#define SBI(x,b) (x|= (1<<b))           // Set bit
+#define CBI(x,b) (x&=~(1<<b))           // Clear bit
+#define TBI(x,b) (x&(1<<b))             // Test bit
+
+// Called once per pass though the main loop, after incoming IR has been processed and just before loop()
+
+void battery_loop_hook(void);
+
+// Called when RX_IRFaces() puts a newly received datagram into the buffer for this face
+
+void datagram_rx_hook( uint8_t face );
+
+// Called on the way into warm sleep, after the sleep animation, while the tile looks like it is off.
+// Cold sleep can only happen after this, so it is the last chance to save anything.
+
+void checkpoint_sleep_hook(void);
+
+// Called just before and just after the pixel buffer is committed to the display each pass, outside
+// of the energy hooks below so that energy accounting sees the scaled pixels that actually get shown.
+// Whatever the begin hook changes in the pixel buffer, the end hook must put back.
+
+void brightness_display_begin_hook(void);
+void brightness_display_end_hook(void);
+
+// Called just before and just after the pixel buffer is committed to the display each pass.
+// The commit waits for vertical blanking, so the time between these two is when the CPU is idle.
+
+void energy_display_begin_hook(void);
+void energy_display_end_hook(void);
+
+// Called every time an IR packet is successfully sent. len is the total packet length in bytes.
+
+void energy_ir_tx_hook( uint8_t len );
+
+/* --- Service packets
+
+   Services can talk to the same service on neighboring tiles using service packets, which share the IR link with
+   values and datagrams. Each service gets a one byte ID. When a face is due to send, TX_IRFaces() asks each service's
+   tx hook in turn if it has anything for that face. The hook writes its payload (up to SERVICE_PAYLOAD_MAX_LEN bytes)
+   and returns the length, or returns 0 if it has nothing to say. We make sure the face value still goes out every other send.
+
+   A tx hook being called does not mean the packet made it - IR is lossy and a send can fail if the neighbor was
+   talking at the same time. Services must keep asking to send until they hear back that it was received.
+   A service that only wants each packet sent once can add a sent hook, which is called when the packet
+   went out without being interrupted (the same promise we make for datagrams).
+
+   When a good service packet comes in, RX_IRFaces() passes the payload to that service's rx hook.
+
+   The per-pass loop hooks are called after incoming IR has been processed, so blinklib_frameState is up to date.
+
+*/
+
+#define SERVICE_PAYLOAD_MAX_LEN ( IR_DATAGRAM_LEN - 1 )     // One byte of the packet goes to the service ID
+
+#define SERVICE_ID_NEIGHBOR     1
+#define SERVICE_ID_COORDS       2
+#define SERVICE_ID_ROUTE        3
+#define SERVICE_ID_TOKEN        4
+#define SERVICE_ID_RANK         5
+#define SERVICE_ID_EPOCH        6
+#define SERVICE_ID_TREE         7
+#define SERVICE_ID_VOTE         8
+#define SERVICE_ID_SYNC         9
+
+// The snapshot that will be passed to loopWithState(). Services can use expiredFaces and stableFaces.
+
+extern FrameState blinklib_frameState;
+
+void neighbor_loop_hook(void);
+uint8_t neighbor_tx_hook( uint8_t face , uint8_t *payload );
+void neighbor_rx_hook( uint8_t face , const uint8_t *payload , uint8_t len );
+
+void coord_loop_hook(void);
+uint8_t coord_tx_hook( uint8_t face , uint8_t *payload );
+void coord_rx_hook( uint8_t face , const uint8_t *payload , uint8_t len );
+
+void route_loop_hook(void);
+uint8_t route_tx_hook( uint8_t face , uint8_t *payload );
+void route_rx_hook( uint8_t face , const uint8_t *payload , uint8_t len );
+void route_sent_hook( uint8_t face );
+
+void token_loop_hook(void);
+uint8_t token_tx_hook( uint8_t face , uint8_t *payload );
+void token_rx_hook( uint8_t face , const uint8_t *payload , uint8_t len );
+
+void rank_loop_hook(void);
+uint8_t rank_tx_hook( uint8_t face , uint8_t *payload );
+void rank_rx_hook( uint8_t face , const uint8_t *payload , uint8_t len );
+
+void epoch_loop_hook(void);
+uint8_t epoch_tx_hook( uint8_t face , uint8_t *payload );
+void epoch_rx_hook( uint8_t face , const uint8_t *payload , uint8_t len );
+
+void tree_loop_hook(void);
+uint8_t tree_tx_hook( uint8_t face , uint8_t *payload );
+void tree_rx_hook( uint8_t face , const uint8_t *payload , uint8_t len );
+
+void vote_loop_hook(void);
+uint8_t vote_tx_hook( uint8_t face , uint8_t *payload );
+void vote_rx_hook( uint8_t face , const uint8_t *payload , uint8_t len );
+
+// The spanning tree itself, for services that use it. These have no weak defaults, so calling
+// one is what pulls tree.cpp in.
+
+#define TREE_NO_FACE            0xff
+
+bool tree_is_root(void);                // We are the root of our tree
+uint8_t tree_parent_face(void);         // TREE_NO_FACE if we have no parent, either because we are the root or the tree is rebuilding
+uint8_t tree_child_bitflags(void);      // A 1 means the neighbor on that face is our child
+word tree_root_id(void);                // NO_TILE_ID while we are in hold down
+bool tree_is_stable(void);              // Our root, parent and children have not changed for a while
+
+void sync_loop_hook(void);
+uint8_t sync_tx_hook( uint8_t face , uint8_t *payload );
+void sync_rx_hook( uint8_t face , const uint8_t *payload , uint8_t len );
+
+#endif /* HOOKS_H_ */
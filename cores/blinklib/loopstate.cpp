@@ -0,0 +1,19 @@
+/*
+
+    Default loopWithState() for sketches that just supply a plain old loop().
+
+    This lives in its own file on purpose. The linker only pulls this in from the core
+    archive if the sketch did not define its own loopWithState(), so sketches that do
+    are not forced to also have a loop().
+
+*/
+
+#include "blinklib.h"
+
+void loopWithState( const FrameState &state ) {
+
+    (void) state;       // The plain loop() gets at this stuff though the accessor functions instead
+
+    loop();
+
+}
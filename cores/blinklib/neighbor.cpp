@@ -0,0 +1,141 @@
+/*
+ * neighbor.cpp
+ *
+ * Find out which tile is across each face, and which of its faces is touching ours.
+ *
+ * When a link comes up, the two tiles swap a tiny service packet with their tile ID (see getTileId()) and
+ * the face they sent it on. Once both sides have heard each other we stop sending, so after the first few
+ * packets this costs nothing until the link breaks and comes back.
+ *
+ * To know when to stop, each announcement carries two flags...
+ *
+ *  KNOWN - I have heard your announcement
+ *  ACKED - I know that you have heard mine
+ *
+ * We keep announcing on a face until we get a packet back with KNOWN set. Whenever we get an announcement
+ * without ACKED set, the sender is still waiting on us so we owe it one more. A clean exchange is 3 packets...
+ *
+ *      A -> B  ( )                 A has not heard from B
+ *      B -> A  ( KNOWN )           B has heard A. A is now done waiting.
+ *      A -> B  ( KNOWN , ACKED )   B is now done waiting and A owes nothing more.
+ *
+ * If any of these gets lost, whoever is still waiting just sends again.
+ *
+ */
+
+#include "blinklib.h"
+
+#include "hooks.h"
+
+#define NEIGHBOR_PAYLOAD_LEN    3       // Tile ID low byte, tile ID high byte, face and flags
+
+#define NEIGHBOR_FACE_MASK      0x07
+#define NEIGHBOR_FLAG_KNOWN     0x80
+#define NEIGHBOR_FLAG_ACKED     0x40
+
+static word neighborIds[FACE_COUNT];            // Last ID heard on each face. Kept after the face expires so we can tell if it comes back different.
+static uint8_t neighborFaces[FACE_COUNT];       // ...and which face of theirs it came from
+
+static uint8_t neighborKnownBitflags;           // A 1 means we have heard from the neighbor on this face since the link came up
+static uint8_t neighborAckedBitflags;           // A 1 means the neighbor on this face has told us it heard us
+static uint8_t neighborOweBitflags;             // A 1 means the neighbor is still waiting to hear from us
+static uint8_t neighborSwapBitflags;            // A 1 means a different neighbor showed up on this face. Cleared when read.
+
+void neighbor_loop_hook() {
+
+    // Forget everything about faces that have gone quiet so we start over when they come back
+
+    uint8_t expired = blinklib_frameState.expiredFaces;
+
+    neighborKnownBitflags &= ~expired;
+    neighborAckedBitflags &= ~expired;
+    neighborOweBitflags   &= ~expired;
+
+}
+
+uint8_t neighbor_tx_hook( uint8_t face , uint8_t *payload ) {
+
+    if ( TBI( neighborAckedBitflags , face ) && !TBI( neighborOweBitflags , face ) ) {
+
+        // Nothing left to say on this face
+
+        return 0;
+
+    }
+
+    word id = getTileId();
+
+    payload[0] = id & 0xff;
+    payload[1] = id >> 8;
+    payload[2] = face;
+
+    if ( TBI( neighborKnownBitflags , face ) ) payload[2] |= NEIGHBOR_FLAG_KNOWN;
+    if ( TBI( neighborAckedBitflags , face ) ) payload[2] |= NEIGHBOR_FLAG_ACKED;
+
+    CBI( neighborOweBitflags , face );      // If this one gets lost, they will send again and we will owe them again
+
+    return NEIGHBOR_PAYLOAD_LEN;
+
+}
+
+void neighbor_rx_hook( uint8_t face , const uint8_t *payload , uint8_t len ) {
+
+    if ( len < NEIGHBOR_PAYLOAD_LEN ) {
+        return;
+    }
+
+    word id = payload[0] | ( payload[1] << 8 );
+    uint8_t theirFace = payload[2] & NEIGHBOR_FACE_MASK;
+
+    if ( id != neighborIds[face] || theirFace != neighborFaces[face] ) {
+
+        SBI( neighborSwapBitflags , face );
+
+        neighborIds[face] = id;
+        neighborFaces[face] = theirFace;
+
+    }
+
+    SBI( neighborKnownBitflags , face );
+
+    if ( payload[2] & NEIGHBOR_FLAG_KNOWN ) {
+
+        SBI( neighborAckedBitflags , face );
+
+    } else {
+
+        // They have not heard us (maybe they just reset) so start over on our side too
+
+        CBI( neighborAckedBitflags , face );
+
+    }
+
+    if ( !( payload[2] & NEIGHBOR_FLAG_ACKED ) ) {
+
+        SBI( neighborOweBitflags , face );
+
+    }
+
+}
+
+word getNeighborId( byte face ) {
+
+    return TBI( neighborKnownBitflags , face ) ? neighborIds[face] : NO_TILE_ID;
+
+}
+
+byte getNeighborFace( byte face ) {
+
+    return TBI( neighborKnownBitflags , face ) ? neighborFaces[face] : NO_NEIGHBOR_FACE;
+
+}
+
+bool didNeighborSwapOnFace( byte face ) {
+
+    bool r = TBI( neighborSwapBitflags , face );
+
+    CBI( neighborSwapBitflags , face );
+
+    return r;
+
+}
@@ -0,0 +1,452 @@
+/*
+ * rank.cpp
+ *
+ * Give every tile in a group a different small number 0..N-1, like "player 0" through "player N-1".
+ *
+ * Every tile keeps a list of the other tiles in the group. Each entry has the tile ID, the tile's epoch (see below),
+ * a heartbeat count that the tile itself bumps once a second, and how long ago that heartbeat happened.
+ * Tiles trade a few entries with their neighbors, so news of every tile spreads across the whole group one hop
+ * at a time. An entry whose heartbeat has not moved in RANK_AGE_TICKS seconds is a tile
+ * that has left, so it drops off everywhere at about the same time. Since the age travels with the entry,
+ * a tile that is gone can not be kept alive by neighbors passing old news back and forth.
+ *
+ * Our rank is just how many tiles sort before us, so it is always dense and everyone agrees once the news has spread.
+ *
+ * Tiles sort by epoch and then by tile ID (which comes from the serial number). When a tile starts up it waits until
+ * it has not heard about any other new tiles for a few seconds and then picks its epoch...
+ *
+ *  - If none of the tiles it knows about were already settled when it showed up, it is part of the
+ *    group that started together and it takes epoch 0. So a group that starts together is ordered by tile ID.
+ *  - Otherwise it is joining an existing group, so it takes an epoch one past the newest one in the group.
+ *    That puts it after everyone already there, so adding a tile does not change anyone else's rank.
+ *
+ * Until a tile settles it sorts after all the settled tiles.
+ *
+ * While any tile in the group is still settling we send every RANK_ADVERT_MS so it hears about everyone quickly.
+ * Once they are all settled we only need each entry to get across each link every RANK_CYCLE_MS or so, which keeps
+ * the news fresh enough to cross the group well before it ages out. Small groups end up sending every
+ * RANK_ADVERT_SETTLED_MS, and only the biggest ones go as fast as while settling.
+ *
+ * Tile IDs are only 16 bits, so two tiles in a group can have the same one. If they did, each would think the other's
+ * entries were its own, and they would end up with the same rank. So every entry also carries a check byte, which is
+ * another hash of the tile's serial number. If we see our own ID with somebody else's check byte, we move to a new
+ * ID made by hashing our serial number again with a different salt. The other tile does the same, and our old
+ * entries age out of everyone's lists. The check byte only tells apart 255 out of 256 tiles that share an ID,
+ * but the odds of both matching are about 1 in 16 million.
+ *
+ */
+
+#include <stddef.h>         // NULL
+
+#include "blinklib.h"
+
+#include "hooks.h"
+
+#define RANK_MAX_TILES          20      // Most other tiles we can keep track of
+
+#define RANK_ADVERT_MS          50      // How often we send some entries on each face while anyone is settling
+#define RANK_CYCLE_MS         1000      // Once everyone is settled, how long we take to send our whole list on each face
+#define RANK_ADVERT_SETTLED_MS 500      // ...but we always send at least this often, so our own heartbeat gets out
+#define RANK_BEAT_MS          1000      // How often we bump our heartbeat and age everyone else's
+#define RANK_SETTLE_MS        3000      // How long it has to be quiet before we pick our epoch
+
+#define RANK_AGE_TICKS          16      // Heartbeats this old (in RANK_BEAT_MS ticks) mean the tile has left
+
+#define RANK_ENTRY_LEN           6      // ID low, ID high, check, epoch, heartbeat, age
+#define RANK_ADVERT_ENTRIES      2      // Entries per packet, including ourselves
+
+#define RANK_CHECK_SALT       0xff      // Salt for the check byte, so it never matches any ID salt
+
+#define RANK_FNV_OFFSET  2166136261UL   // 32 bit FNV-1a, same as getTileId()
+#define RANK_FNV_PRIME   16777619UL
+
+#if ( RANK_ENTRY_LEN * RANK_ADVERT_ENTRIES ) > SERVICE_PAYLOAD_MAX_LEN
+    #error Rank entries do not fit in a service packet
+#endif
+
+// The epoch byte...
+//  bits 0-5    epoch
+//  bit 6       only used in our list - we saw this tile before it was settled, so it started along with us
+//  bit 7       not settled yet. Makes it sort after everyone who is.
+
+#define RANK_EPOCH_MASK         0x3f
+#define RANK_SEEN_UNSETTLED     0x40
+#define RANK_UNSETTLED          0x80
+
+#define RANK_KEY_MASK           ( RANK_UNSETTLED | RANK_EPOCH_MASK )
+
+struct rank_t {
+
+    word id;
+    uint8_t check;
+    uint8_t epoch;
+    uint8_t beat;
+    uint8_t age;
+
+};
+
+static rank_t ranks[RANK_MAX_TILES];
+static uint8_t rankCount;
+
+static word rankId;                             // Our ID in the lists. getTileId() unless it turned out to be taken.
+static uint8_t rankCheck;
+static uint8_t rankSalt;
+
+static uint8_t rankEpoch = RANK_UNSETTLED;
+static uint8_t rankBeat;
+
+static uint8_t rankCursor[FACE_COUNT];          // Next list entry to send on each face
+
+static unsigned long rankAdvertTime;
+static unsigned long rankBeatTime;
+static unsigned long rankSettleTime;            // 0 until we start
+
+static uint8_t rankAdvertBitflags;              // A 1 means it is time to send on this face
+
+static uint32_t rank_hash( uint8_t salt ) {
+
+    uint32_t hash = RANK_FNV_OFFSET;
+
+    hash ^= salt;
+    hash *= RANK_FNV_PRIME;
+
+    for( uint8_t n = 0 ; n < SERIAL_NUMBER_LEN ; n++ ) {
+
+        hash ^= getSerialNumberByte( n );
+        hash *= RANK_FNV_PRIME;
+
+    }
+
+    return hash;
+
+}
+
+static void rank_start() {
+
+    rankId = getTileId();
+    rankCheck = rank_hash( RANK_CHECK_SALT ) >> 24;
+
+}
+
+// Somebody else has our ID, so take another one
+
+static void rank_new_id() {
+
+    uint32_t hash = rank_hash( ++rankSalt );
+
+    rankId = (word) ( hash >> 16 ) ^ (word) hash;
+
+    if ( rankId == NO_TILE_ID ) {
+
+        rankId = 1;         // Same as getTileId()
+
+    }
+
+}
+
+static rank_t *rank_find( word id ) {
+
+    rank_t *e = ranks;
+
+    for( uint8_t i = 0 ; i < rankCount ; i++ ) {       // WCET: 20 (RANK_MAX_TILES)
+
+        if ( e->id == id ) {
+
+            return e;
+
+        }
+
+        e++;
+
+    }
+
+    return NULL;
+
+}
+
+static void rank_learn( const uint8_t *p ) {
+
+    word id = p[0] | ( p[1] << 8 );
+
+    uint8_t check = p[2];
+    uint8_t epoch = p[3] & ( RANK_UNSETTLED | RANK_EPOCH_MASK );
+    uint8_t beat = p[4];
+    uint8_t age = p[5];
+
+    if ( id == NO_TILE_ID || age >= RANK_AGE_TICKS ) {
+
+        return;
+
+    }
+
+    if ( id == rankId ) {
+
+        if ( check != rankCheck ) {
+
+            rank_new_id();
+
+        }
+
+        // Otherwise it is just news about us coming back around
+
+        return;
+
+    }
+
+    rank_t *e = rank_find( id );
+
+    if ( !e ) {
+
+        if ( rankCount == RANK_MAX_TILES ) {
+
+            return;
+
+        }
+
+        e = &ranks[ rankCount++ ];
+
+        e->id = id;
+        e->epoch = 0;
+        e->beat = beat - 1;         // So the news below counts as newer
+
+        if ( rankEpoch & RANK_UNSETTLED ) {
+
+            rankSettleTime = millis() + RANK_SETTLE_MS;     // Someone new, so wait for things to quiet down
+
+        }
+
+    }
+
+    // Take a newer heartbeat, or fresher news of the same one
+
+    int8_t newer = beat - e->beat;
+
+    if ( newer > 0 || ( newer == 0 && age < e->age ) ) {
+
+        e->beat = beat;
+        e->age = age;
+        e->check = check;
+        e->epoch = epoch | ( e->epoch & RANK_SEEN_UNSETTLED );
+
+        if ( epoch & RANK_UNSETTLED ) {
+
+            e->epoch |= RANK_SEEN_UNSETTLED;
+
+        }
+
+    }
+
+}
+
+// How long until we send again. Fast while anyone we know of is still settling, otherwise
+// just fast enough to get through our whole list (one entry per packet) every RANK_CYCLE_MS.
+
+static uint16_t rank_advert_interval() {
+
+    if ( rankEpoch & RANK_UNSETTLED ) {
+
+        return RANK_ADVERT_MS;
+
+    }
+
+    rank_t *e = ranks;
+
+    for( uint8_t i = 0 ; i < rankCount ; i++ ) {       // WCET: 20 (RANK_MAX_TILES)
+
+        if ( e->epoch & RANK_UNSETTLED ) {
+
+            return RANK_ADVERT_MS;
+
+        }
+
+        e++;
+
+    }
+
+    if ( rankCount <= RANK_CYCLE_MS / RANK_ADVERT_SETTLED_MS ) {
+
+        return RANK_ADVERT_SETTLED_MS;
+
+    }
+
+    return RANK_CYCLE_MS / rankCount;
+
+}
+
+static void rank_settle() {
+
+    // Find the newest epoch among tiles that were already settled when we first heard of them
+
+    uint8_t epoch = 0;
+
+    rank_t *e = ranks;
+
+    for( uint8_t i = 0 ; i < rankCount ; i++ ) {       // WCET: 20 (RANK_MAX_TILES)
+
+        if ( !( e->epoch & ( RANK_UNSETTLED | RANK_SEEN_UNSETTLED ) ) ) {
+
+            uint8_t next = ( e->epoch & RANK_EPOCH_MASK ) + 1;
+
+            if ( next > epoch && next <= RANK_EPOCH_MASK ) {
+
+                epoch = next;
+
+            }
+
+        }
+
+        e++;
+
+    }
+
+    rankEpoch = epoch;
+
+}
+
+void rank_loop_hook() {
+
+    unsigned long now = millis();
+
+    if ( !rankSettleTime ) {
+
+        rank_start();
+
+        rankSettleTime = now + RANK_SETTLE_MS;
+
+    }
+
+    if ( ( rankEpoch & RANK_UNSETTLED ) && rankSettleTime <= now ) {
+
+        rank_settle();
+
+    }
+
+    if ( rankAdvertTime <= now ) {
+
+        rankAdvertTime = now + rank_advert_interval();
+
+        rankAdvertBitflags = ALL_FACES_MASK & ~blinklib_frameState.expiredFaces;
+
+    }
+
+    if ( rankBeatTime <= now ) {
+
+        rankBeatTime = now + RANK_BEAT_MS;
+
+        rankBeat++;
+
+        // Everyone else gets older. Drop the ones that are gone by moving the last entry into their spot.
+
+        uint8_t i = 0;
+
+        while ( i < rankCount ) {                       // WCET: 20 (RANK_MAX_TILES)
+
+            rank_t *e = &ranks[i];
+
+            if ( ++e->age >= RANK_AGE_TICKS ) {
+
+                *e = ranks[ --rankCount ];
+
+            } else {
+
+                i++;
+
+            }
+
+        }
+
+    }
+
+}
+
+static uint8_t *rank_put( uint8_t *p , word id , uint8_t check , uint8_t epoch , uint8_t beat , uint8_t age ) {
+
+    *p++ = id & 0xff;
+    *p++ = id >> 8;
+    *p++ = check;
+    *p++ = epoch & ( RANK_UNSETTLED | RANK_EPOCH_MASK );
+    *p++ = beat;
+    *p++ = age;
+
+    return p;
+
+}
+
+uint8_t rank_tx_hook( uint8_t face , uint8_t *payload ) {
+
+    if ( !TBI( rankAdvertBitflags , face ) ) {
+
+        return 0;
+
+    }
+
+    CBI( rankAdvertBitflags , face );
+
+    // Always ourselves first
+
+    uint8_t *p = rank_put( payload , rankId , rankCheck , rankEpoch , rankBeat , 0 );
+
+    // Then the next few from our list
+
+    for( uint8_t n = 1 ; n < RANK_ADVERT_ENTRIES && n <= rankCount ; n++ ) {      // WCET: 1
+
+        uint8_t *cursor = &rankCursor[face];
+
+        if ( *cursor >= rankCount ) {
+            *cursor = 0;
+        }
+
+        rank_t *e = &ranks[ (*cursor)++ ];
+
+        p = rank_put( p , e->id , e->check , e->epoch , e->beat , e->age );
+
+    }
+
+    return p - payload;
+
+}
+
+void rank_rx_hook( uint8_t /*face*/ , const uint8_t *payload , uint8_t len ) {
+
+    while ( len >= RANK_ENTRY_LEN ) {       // WCET: 2 (SERVICE_PAYLOAD_MAX_LEN / RANK_ENTRY_LEN)
+
+        rank_learn( payload );
+
+        payload += RANK_ENTRY_LEN;
+        len -= RANK_ENTRY_LEN;
+
+    }
+
+}
+
+byte getRank() {
+
+    word self = rankId;
+
+    uint8_t rank = 0;
+
+    rank_t *e = ranks;
+
+    for( uint8_t i = 0 ; i < rankCount ; i++ ) {       // WCET: 20 (RANK_MAX_TILES)
+
+        uint8_t key = e->epoch & RANK_KEY_MASK;
+
+        if ( key < rankEpoch || ( key == rankEpoch && e->id < self ) ) {
+
+            rank++;
+
+        }
+
+        e++;
+
+    }
+
+    return rank;
+
+}
+
+byte getClusterSize() {
+
+    return rankCount + 1;
+
+}
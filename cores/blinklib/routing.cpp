@@ -0,0 +1,452 @@
+/*
+ * routing.cpp
+ *
+ * Send a short message to any tile in the group by its tile ID, passed along from tile to tile.
+ *
+ * Every tile keeps a small table of the tiles it has heard of, which face leads toward each one, and how
+ * many hops away it is. Once a second each tile tells its neighbors a few entries from its table (plus itself
+ * at 0 hops), working through the whole table a few entries at a time. A neighbor that is one hop closer
+ * to a tile than we know of becomes our way to get there. This is the classic distance vector scheme.
+ *
+ * When we tell a neighbor about a route that goes through that very neighbor, we say it is unreachable instead
+ * (poison reverse). That stops two tiles from bouncing a dead route back and forth.
+ *
+ * When a face expires, every route through it is dropped right away and the neighbors fill in
+ * any other way around on their next updates. Routes we have not heard about for a while age out too.
+ *
+ * A message only goes along the path to its destination, so sending costs the same no matter how many
+ * tiles are in the group. Each one carries a hop limit so a message can never go around in circles forever.
+ *
+ * Like datagrams, messages are best effort. There is room for one message being forwarded and one
+ * received message waiting for the sketch. Anything that comes along while these are full is dropped.
+ *
+ */
+
+#include <string.h>         // memcpy()
+
+#include "blinklib.h"
+
+#include "hooks.h"
+
+#define ROUTE_TABLE_SIZE        12      // Most tiles we can keep track of at once
+
+#define ROUTE_ADVERT_MS       1000      // How often we tell each neighbor some of our routes
+#define ROUTE_AGE_MS          8000      // Routes not heard about in this long are dropped. Must be long enough to get through the whole table.
+
+#define ROUTE_ADVERT_ENTRIES     4      // Entries per advertisement, including ourselves
+
+#define ROUTE_TYPE_ADVERT        1      // Payload is type, then ( ID low , ID high , hops ) for each entry
+#define ROUTE_TYPE_DATA          2      // Payload is type, destination ID, source ID, hops left, then data
+
+#define ROUTE_DATA_HEADER_LEN    6
+
+#if ROUTE_DATA_MAX_LEN != ( SERVICE_PAYLOAD_MAX_LEN - ROUTE_DATA_HEADER_LEN )
+    #error ROUTE_DATA_MAX_LEN in blinklib.h does not match the space in a service packet
+#endif
+
+// Each route packs into one byte along with the ID...
+//  bits 0-3    hops. 0 means the slot is empty, since a real route is always at least 1 hop.
+//  bits 4-6    face that leads toward the tile
+//  bit 7       stale. Set each time routes age and cleared whenever we hear about the route.
+
+#define ROUTE_HOPS_MASK         0x0f
+#define ROUTE_HOPS_NONE         0x0f    // Unreachable. We send this in advertisements but never store it.
+#define ROUTE_EMPTY             0x00
+#define ROUTE_FACE_SHIFT        4
+#define ROUTE_FACE_MASK         0x70
+#define ROUTE_STALE_BIT         0x80
+
+struct route_t {
+
+    word id;
+    uint8_t info;
+
+};
+
+static route_t routes[ROUTE_TABLE_SIZE];
+
+static uint8_t routeAdvertCursor[FACE_COUNT];   // Next table entry to advertise on each face. One per face so each face gets the whole table.
+static uint8_t routeAdvertBitflags;             // A 1 means it is time to send an advertisement on this face
+
+static unsigned long routeAdvertTime;
+static unsigned long routeAgeTime;
+
+// One message on its way out...
+
+static uint8_t routeOutLen;                     // 0 = empty
+static uint8_t routeOutFace;
+static uint8_t routeOutData[SERVICE_PAYLOAD_MAX_LEN];
+
+// ...and one that came in for us
+
+static uint8_t routeInLen;                      // 0 = empty
+static word routeInSource;
+static uint8_t routeInData[ROUTE_DATA_MAX_LEN];
+
+static route_t *route_find( word id ) {
+
+    route_t *r = routes;
+
+    for( uint8_t i = 0 ; i < ROUTE_TABLE_SIZE ; i++ ) {
+
+        if ( ( r->info & ROUTE_HOPS_MASK ) != ROUTE_EMPTY && r->id == id ) {
+
+            return r;
+
+        }
+
+        r++;
+
+    }
+
+    return NULL;
+
+}
+
+static void route_learn( word id , uint8_t hops , uint8_t face ) {
+
+    route_t *r = route_find( id );
+
+    if ( r ) {
+
+        uint8_t oldHops = r->info & ROUTE_HOPS_MASK;
+        uint8_t oldFace = ( r->info & ROUTE_FACE_MASK ) >> ROUTE_FACE_SHIFT;
+
+        if ( oldFace != face && hops >= oldHops ) {
+
+            // We already have a way that is at least as good
+
+            return;
+
+        }
+
+        // Either a better way, or news about the way we are using. Take it even if it got worse or went away.
+
+    } else {
+
+        if ( hops >= ROUTE_HOPS_NONE ) {
+
+            return;
+
+        }
+
+        // New tile. Use an empty slot, or bump the farthest tile if this one is closer.
+
+        route_t *slot = routes;
+        uint8_t worstHops = 0;
+
+        route_t *p = routes;
+
+        for( uint8_t i = 0 ; i < ROUTE_TABLE_SIZE ; i++ ) {
+
+            uint8_t h = p->info & ROUTE_HOPS_MASK;
+
+            if ( h == ROUTE_EMPTY ) {
+                h = ROUTE_HOPS_NONE;        // Empty slots are the first choice
+            }
+
+            if ( h > worstHops ) {
+
+                worstHops = h;
+                slot = p;
+
+            }
+
+            p++;
+
+        }
+
+        if ( worstHops <= hops ) {
+
+            return;         // Table full of closer tiles
+
+        }
+
+        r = slot;
+        r->id = id;
+
+    }
+
+    if ( hops >= ROUTE_HOPS_NONE ) {
+
+        r->info = ROUTE_EMPTY;          // The way we were using is gone
+
+    } else {
+
+        r->info = hops | ( face << ROUTE_FACE_SHIFT );        // Also clears stale
+
+    }
+
+}
+
+void route_loop_hook() {
+
+    // Drop any routes through faces that just went away
+
+    uint8_t expired = blinklib_frameState.expiredFaces;
+
+    route_t *r = routes;
+
+    for( uint8_t i = 0 ; i < ROUTE_TABLE_SIZE ; i++ ) {
+
+        if ( TBI( expired , ( r->info & ROUTE_FACE_MASK ) >> ROUTE_FACE_SHIFT ) ) {
+
+            r->info = ROUTE_EMPTY;
+
+        }
+
+        r++;
+
+    }
+
+    if ( routeAdvertTime <= millis() ) {
+
+        routeAdvertTime = millis() + ROUTE_ADVERT_MS;
+
+        routeAdvertBitflags = ALL_FACES_MASK & ~expired;
+
+    }
+
+    if ( routeAgeTime <= millis() ) {
+
+        routeAgeTime = millis() + ROUTE_AGE_MS;
+
+        // Anything still stale from last time is gone. Everything else is stale until we hear about it again.
+
+        r = routes;
+
+        for( uint8_t i = 0 ; i < ROUTE_TABLE_SIZE ; i++ ) {
+
+            if ( r->info & ROUTE_STALE_BIT ) {
+
+                r->info = ROUTE_EMPTY;
+
+            } else if ( r->info != ROUTE_EMPTY ) {
+
+                r->info |= ROUTE_STALE_BIT;
+
+            }
+
+            r++;
+
+        }
+
+    }
+
+}
+
+uint8_t route_tx_hook( uint8_t face , uint8_t *payload ) {
+
+    // Messages first
+
+    if ( routeOutLen && routeOutFace == face ) {
+
+        memcpy( payload , routeOutData , routeOutLen );
+
+        return routeOutLen;
+
+    }
+
+    if ( !TBI( routeAdvertBitflags , face ) ) {
+
+        return 0;
+
+    }
+
+    CBI( routeAdvertBitflags , face );
+
+    uint8_t *p = payload;
+
+    *p++ = ROUTE_TYPE_ADVERT;
+
+    // Always start with ourselves
+
+    word id = getTileId();
+
+    *p++ = id & 0xff;
+    *p++ = id >> 8;
+    *p++ = 0;
+
+    // Then the next few table entries
+
+    for( uint8_t n = 1 ; n < ROUTE_ADVERT_ENTRIES ; n++ ) {
+
+        route_t *r = &routes[ routeAdvertCursor[face] ];
+
+        if ( ++routeAdvertCursor[face] == ROUTE_TABLE_SIZE ) {
+            routeAdvertCursor[face] = 0;
+        }
+
+        uint8_t hops = r->info & ROUTE_HOPS_MASK;
+
+        if ( hops == ROUTE_EMPTY ) {
+            continue;
+        }
+
+        if ( ( ( r->info & ROUTE_FACE_MASK ) >> ROUTE_FACE_SHIFT ) == face ) {
+
+            hops = ROUTE_HOPS_NONE;         // Poison reverse - no sense sending them back to themselves
+
+        }
+
+        *p++ = r->id & 0xff;
+        *p++ = r->id >> 8;
+        *p++ = hops;
+
+    }
+
+    return p - payload;
+
+}
+
+void route_sent_hook( uint8_t face ) {
+
+    if ( routeOutLen && routeOutFace == face ) {
+
+        routeOutLen = 0;
+
+    }
+
+}
+
+// Queue a data packet toward dest. Returns false if there is no route or the outgoing slot is busy.
+
+static bool route_forward( word dest , word source , uint8_t hopsLeft , const uint8_t *data , uint8_t len ) {
+
+    if ( routeOutLen || !hopsLeft ) {
+
+        return false;
+
+    }
+
+    route_t *r = route_find( dest );
+
+    if ( !r ) {
+
+        return false;
+
+    }
+
+    routeOutFace = ( r->info & ROUTE_FACE_MASK ) >> ROUTE_FACE_SHIFT;
+
+    uint8_t *p = routeOutData;
+
+    *p++ = ROUTE_TYPE_DATA;
+    *p++ = dest & 0xff;
+    *p++ = dest >> 8;
+    *p++ = source & 0xff;
+    *p++ = source >> 8;
+    *p++ = hopsLeft;
+
+    memcpy( p , data , len );
+
+    routeOutLen = ROUTE_DATA_HEADER_LEN + len;
+
+    return true;
+
+}
+
+void route_rx_hook( uint8_t face , const uint8_t *payload , uint8_t len ) {
+
+    if ( len < 1 ) {
+        return;
+    }
+
+    const uint8_t *p = payload + 1;
+
+    if ( payload[0] == ROUTE_TYPE_ADVERT ) {
+
+        word self = getTileId();
+
+        for( uint8_t n = ( len - 1 ) / 3 ; n ; n-- ) {        // WCET: 4 (( SERVICE_PAYLOAD_MAX_LEN - 1 ) / 3)
+
+            word id = p[0] | ( p[1] << 8 );
+
+            uint8_t hops = p[2] + 1;
+
+            if ( hops > ROUTE_HOPS_NONE ) {
+                hops = ROUTE_HOPS_NONE;
+            }
+
+            if ( id != self ) {
+
+                route_learn( id , hops , face );
+
+            }
+
+            p += 3;
+
+        }
+
+    } else if ( payload[0] == ROUTE_TYPE_DATA && len >= ROUTE_DATA_HEADER_LEN ) {
+
+        word dest   = p[0] | ( p[1] << 8 );
+        word source = p[2] | ( p[3] << 8 );
+        uint8_t hopsLeft = p[4];
+
+        const uint8_t *data = payload + ROUTE_DATA_HEADER_LEN;
+        uint8_t dataLen = len - ROUTE_DATA_HEADER_LEN;
+
+        if ( dest == getTileId() ) {
+
+            if ( !routeInLen && dataLen ) {
+
+                memcpy( routeInData , data , dataLen );
+                routeInSource = source;
+                routeInLen = dataLen;
+
+            }
+
+        } else {
+
+            route_forward( dest , source , hopsLeft - 1 , data , dataLen );
+
+        }
+
+    }
+
+}
+
+bool sendToTile( word id , const void *data , byte len ) {
+
+    if ( len == 0 || len > ROUTE_DATA_MAX_LEN ) {
+
+        return false;
+
+    }
+
+    return route_forward( id , getTileId() , ROUTE_HOPS_NONE , (const uint8_t *) data , len );
+
+}
+
+byte getHopsToTile( word id ) {
+
+    route_t *r = route_find( id );
+
+    return r ? ( r->info & ROUTE_HOPS_MASK ) : NO_ROUTE_HOPS;
+
+}
+
+byte getTileMessageLength() {
+
+    return routeInLen;
+
+}
+
+const byte *getTileMessage() {
+
+    return routeInData;
+
+}
+
+word getTileMessageSource() {
+
+    return routeInSource;
+
+}
+
+void markTileMessageRead() {
+
+    routeInLen = 0;
+
+}
@@ -49,7 +49,7 @@ void sp_serial_init(void) {
 
 void sp_serial_tx(unsigned char b) {
 
-    while (!TBI(SP_SERIAL_CTRL_REG,UDRE0));         // Wait for buffer to be clear so we don't overwrite in progress
+    while (!TBI(SP_SERIAL_CTRL_REG,UDRE0));         // WCET: 16 - Wait for buffer to be clear so we don't overwrite in progress. One byte at 1Mbd is 80 cycles.
 
     SP_SERIAL_DATA_REG=b;                           // Send new byte
 
@@ -59,7 +59,7 @@ void sp_serial_tx(unsigned char b) {
 
 void sp_serial_flush(void) {
 
-    while (!TBI(SP_SERIAL_CTRL_REG,TXC0));         // Wait until the entire frame in the Transmit Shift Register has been shifted out and there are
+    while (!TBI(SP_SERIAL_CTRL_REG,TXC0));         // WCET: 32 - Wait until the entire frame in the Transmit Shift Register has been shifted out and there are
                                                    // no new data currently present in the transmit buffer
 
 }
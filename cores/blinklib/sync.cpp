@@ -0,0 +1,343 @@
+/*
+ * sync.cpp
+ *
+ * A frame counter shared by a whole group of tiles, so a light show can have every tile showing the same frame
+ * at the same moment even though each tile's clock runs a little fast or slow.
+ *
+ * Each tile keeps its own copy of a shared clock in milliseconds and the frame number is just that clock
+ * divided by SHARED_FRAME_MS. Every few hundred milliseconds each tile sends its neighbors its clock, and also
+ * echoes back the last clock it got from them along with how long it held onto it. The echo lets the neighbor
+ * work out how long the round trip took, so it can allow for the time the packet spent getting there.
+ *
+ * When we hear from a neighbor, we work out how far apart our clocks are...
+ *
+ *  - If we are way off (like when two groups get pushed together) the one that is behind jumps ahead to the one
+ *    that is ahead. That way frames only ever go forward.
+ *  - Otherwise, if the neighbor is our parent in the spanning tree from tree.cpp, we follow it. We run a little
+ *    faster or slower until we have made up the difference, and we also nudge our normal rate a step towards
+ *    theirs. Over time every tile ends up running at the same rate as the root, so there is less to make up each time.
+ *
+ * Following just our parent (and not averaging everyone) means there is one clock setting the pace and nobody
+ * gets pulled back and forth between neighbors that disagree.
+ *
+ * We also keep track of the worst difference we have seen from any neighbor, so the sketch can see how well
+ * it is working.
+ *
+ */
+
+#include "blinklib.h"
+
+#include "hooks.h"
+
+#define SYNC_PAYLOAD_LEN        7       // Clock (4 bytes, low byte first), echo low, echo high, hold
+
+#define SYNC_NO_HOLD         0xff       // Nothing to echo, or we held it too long for the round trip to mean anything
+
+#define SYNC_ADVERT_MS        200       // How often we send our clock on each face
+#define SYNC_REPORT_MS       1000       // How often we update the number getSharedFrameError() returns
+#define SYNC_JUMP_MS          100       // Further apart than this and we just jump to whichever clock is ahead
+#define SYNC_MAX_RTT_MS       100       // A round trip longer than this is too far off to use for fine tuning
+
+#define SYNC_BIG_STEP_MS    60000       // Bigger than this and we just add it without trimming, so the math below can not overflow
+
+// Rates are in 1/1024ths of normal speed
+
+#define SYNC_RATE_ONE        1024
+#define SYNC_RATE_MAX          40       // Most we trim our normal rate by (about 4%)
+#define SYNC_SLEW_RATE         64       // How much faster or slower we run while making up a difference (about 6%)
+#define SYNC_NUDGE_MAX          2       // Most we change our normal rate by for each packet from our parent
+
+static unsigned long syncClock;         // Our copy of the shared clock in ms
+static uint16_t syncFrac;               // Plus this many 1/1024ths of a ms
+static int8_t syncRate;                 // Our normal rate is SYNC_RATE_ONE plus this
+static long syncSlew;                   // 1/1024ths of a ms we still need to make up (negative means we need to lose it)
+
+static unsigned long syncLastMillis;    // millis() the last time we moved the clock along
+
+static uint16_t syncEchoClock[FACE_COUNT];      // Low bits of the last clock we got on each face...
+static uint16_t syncEchoTime[FACE_COUNT];       // ...and the low bits of millis() when we got it
+static uint8_t syncEchoBitflags;        // A 1 means we have something to echo back on this face
+
+static uint8_t syncSendBitflags;        // A 1 means it is time to send on this face
+
+static uint8_t syncWorst;               // Worst difference from a neighbor since the last report
+static uint8_t syncError;               // What getSharedFrameError() returns
+
+static unsigned long syncAdvertTime;
+static unsigned long syncReportTime;
+
+// Move the shared clock along to match millis()
+
+static void sync_update() {
+
+    unsigned long ms = millis();
+
+    unsigned long elapsed = ms - syncLastMillis;
+
+    syncLastMillis = ms;
+
+    if ( elapsed > SYNC_BIG_STEP_MS ) {
+
+        syncClock += elapsed;
+
+        return;
+
+    }
+
+    long step = (long) elapsed * ( SYNC_RATE_ONE + syncRate );
+
+    // Make up some of the difference, but not more than we have left to make up
+
+    long slew = (long) elapsed * SYNC_SLEW_RATE;
+
+    if ( syncSlew >= 0 ) {
+
+        if ( slew > syncSlew ) {
+
+            slew = syncSlew;
+
+        }
+
+    } else {
+
+        slew = -slew;
+
+        if ( slew < syncSlew ) {
+
+            slew = syncSlew;
+
+        }
+
+    }
+
+    syncSlew -= slew;
+
+    step += slew + syncFrac;
+
+    syncClock += step >> 10;
+    syncFrac = step & ( SYNC_RATE_ONE - 1 );
+
+}
+
+void sync_loop_hook() {
+
+    sync_update();
+
+    uint8_t expired = blinklib_frameState.expiredFaces;
+
+    // Anything we had to echo from a neighbor that has gone away is stale
+
+    syncEchoBitflags &= ~expired;
+
+    unsigned long now = millis();
+
+    if ( syncAdvertTime <= now ) {
+
+        syncAdvertTime = now + SYNC_ADVERT_MS;
+
+        syncSendBitflags = ALL_FACES_MASK & ~expired;
+
+    }
+
+    if ( syncReportTime <= now ) {
+
+        syncReportTime = now + SYNC_REPORT_MS;
+
+        syncError = syncWorst;
+        syncWorst = 0;
+
+        // The root sets the pace for everyone else, so it eases back towards running at normal speed.
+        // Otherwise a tile that had sped up to keep up with its old parent would stay that way.
+
+        if ( tree_is_root() ) {
+
+            if ( syncRate > 0 ) {
+
+                syncRate--;
+
+            } else if ( syncRate < 0 ) {
+
+                syncRate++;
+
+            }
+
+        }
+
+    }
+
+}
+
+uint8_t sync_tx_hook( uint8_t face , uint8_t *payload ) {
+
+    if ( !TBI( syncSendBitflags , face ) ) {
+
+        return 0;
+
+    }
+
+    CBI( syncSendBitflags , face );
+
+    sync_update();
+
+    unsigned long clock = syncClock;
+
+    payload[0] = clock & 0xff;
+    payload[1] = ( clock >> 8 ) & 0xff;
+    payload[2] = ( clock >> 16 ) & 0xff;
+    payload[3] = clock >> 24;
+
+    uint8_t hold = SYNC_NO_HOLD;
+
+    if ( TBI( syncEchoBitflags , face ) ) {
+
+        uint16_t held = (uint16_t) millis() - syncEchoTime[face];
+
+        if ( held < SYNC_NO_HOLD ) {
+
+            hold = held;
+
+        }
+
+    }
+
+    payload[4] = syncEchoClock[face] & 0xff;
+    payload[5] = syncEchoClock[face] >> 8;
+    payload[6] = hold;
+
+    return SYNC_PAYLOAD_LEN;
+
+}
+
+void sync_rx_hook( uint8_t face , const uint8_t *payload , uint8_t len ) {
+
+    if ( len < SYNC_PAYLOAD_LEN ) {
+        return;
+    }
+
+    sync_update();
+
+    unsigned long theirClock = payload[0] | ( (unsigned long) payload[1] << 8 ) | ( (unsigned long) payload[2] << 16 ) | ( (unsigned long) payload[3] << 24 );
+
+    uint16_t echo = payload[4] | ( payload[5] << 8 );
+    uint8_t hold = payload[6];
+
+    // Save their clock to echo back
+
+    syncEchoClock[face] = theirClock;
+    syncEchoTime[face] = millis();
+    SBI( syncEchoBitflags , face );
+
+    // Our children time their round trips off of us, so answer them right away. The less time we hold
+    // onto their clock, the less it matters that our clock runs at a different rate than theirs.
+
+    if ( TBI( tree_child_bitflags() , face ) ) {
+
+        SBI( syncSendBitflags , face );
+
+    }
+
+    // Their clock was sent a while ago. If they echoed ours, half the round trip is about how long ago.
+
+    uint8_t tuneFlag = 0;
+
+    if ( hold != SYNC_NO_HOLD ) {
+
+        // The hold was timed by their clock, so a very quick round trip can come out a little under 0
+
+        int16_t rtt = (uint16_t) syncClock - echo - hold;
+
+        if ( rtt > -SYNC_MAX_RTT_MS && rtt < SYNC_MAX_RTT_MS ) {
+
+            if ( rtt > 0 ) {
+
+                theirClock += rtt / 2;
+
+            }
+
+            tuneFlag = 1;
+
+        }
+
+    }
+
+    long diff = theirClock - syncClock;
+
+    if ( diff > SYNC_JUMP_MS ) {
+
+        // Way behind. Catch up all at once.
+
+        syncClock = theirClock;
+        syncSlew = 0;
+
+        syncSendBitflags = ALL_FACES_MASK;      // Pass it along
+
+        return;
+
+    }
+
+    if ( diff < -SYNC_JUMP_MS ) {
+
+        // They are way behind. Let them know so they can catch up.
+
+        SBI( syncSendBitflags , face );
+
+        return;
+
+    }
+
+    uint8_t off = diff < 0 ? -diff : diff;
+
+    if ( off > syncWorst ) {
+
+        syncWorst = off;
+
+    }
+
+    if ( tuneFlag && face == tree_parent_face() ) {
+
+        // Follow our parent. Start making up half the difference (the next round will get most of the rest),
+        // and nudge our normal rate towards theirs so there is less to make up next time.
+
+        syncSlew = diff * ( SYNC_RATE_ONE / 2 );
+
+        int8_t nudge = diff > SYNC_NUDGE_MAX ? SYNC_NUDGE_MAX : diff < -SYNC_NUDGE_MAX ? -SYNC_NUDGE_MAX : diff;
+
+        syncRate += nudge;
+
+        if ( syncRate > SYNC_RATE_MAX ) {
+
+            syncRate = SYNC_RATE_MAX;
+
+        } else if ( syncRate < -SYNC_RATE_MAX ) {
+
+            syncRate = -SYNC_RATE_MAX;
+
+        }
+
+    }
+
+}
+
+word getSharedFrame() {
+
+    sync_update();
+
+    return syncClock / SHARED_FRAME_MS;
+
+}
+
+byte getSharedFramePhase() {
+
+    sync_update();
+
+    // Count the fraction of a ms too, so the last ms of the frame reaches 255
+
+    return ( ( syncClock % SHARED_FRAME_MS ) * SYNC_RATE_ONE + syncFrac ) * 256 / ( SHARED_FRAME_MS * SYNC_RATE_ONE );
+
+}
+
+byte getSharedFrameError() {
+
+    return syncError;
+
+}
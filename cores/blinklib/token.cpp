@@ -0,0 +1,371 @@
+/*
+ * token.cpp
+ *
+ * Pass a single "turn" around a group of tiles, for turn based games.
+ *
+ * The token walks the spanning tree from tree.cpp depth first. When it comes down from our parent it is our turn.
+ * When the sketch passes it, it goes to our next child clockwise from where it came in, or back up to our parent
+ * once all our children have had it. Going back up does not stop for a turn - each tile just passes it along to its next child
+ * or its own parent. When it gets back to the root, the round is over and the root gets the next turn.
+ * Every move is one packet over one IR hop.
+ *
+ * A token is only gone from the sender once the receiver acks it. Until then we keep resending it.
+ *
+ * Each token is stamped with a generation number, a sequence number that goes up every time it moves, and
+ * the ID of the tile that last moved it. Every tile tells its neighbors the newest stamp it has heard of,
+ * and the tile holding the token bumps the sequence once a second so everyone can tell it is still around.
+ *
+ *  - If a tile is holding a token and hears of a newer one, its token must be a duplicate so it drops it.
+ *  - If the root has not heard anything new about the token in a while, it must have been lost
+ *    (maybe the tile holding it was pulled away) so the root makes a new one in the next generation.
+ *
+ */
+
+#include "blinklib.h"
+
+#include "hooks.h"
+
+#define TOKEN_TYPE_NEWS         1       // type, newest stamp we have heard of
+#define TOKEN_TYPE_TOKEN        2       // type, stamp
+#define TOKEN_TYPE_ACK          3       // type, stamp of the token we got
+
+#define TOKEN_STAMP_LEN         5       // generation, sequence low, sequence high, tile ID low, tile ID high
+
+#define TOKEN_PAYLOAD_LEN       ( 1 + TOKEN_STAMP_LEN )
+
+#define TOKEN_NO_FACE           0xff    // Token came from nowhere. It is the start of a new round.
+
+#define TOKEN_REFRESH_MS        1000    // How often we resend the news on every face and bump the sequence while holding the token
+#define TOKEN_LOST_MS           4000    // Root makes a new token if it has not heard anything new for this long
+
+#define TOKEN_STATE_NONE        0
+#define TOKEN_STATE_HOLD        1       // It is our turn
+#define TOKEN_STATE_PASSING     2       // Sending to tokenOutFace until we get an ack
+
+struct token_stamp_t {
+
+    uint8_t gen;
+    word seq;
+    word id;
+
+};
+
+static uint8_t tokenState;
+static uint8_t tokenInFace;                     // Face the token came in on
+static uint8_t tokenOutFace;                    // Face we are passing it out on
+
+static token_stamp_t tokenNewest;               // Newest token we have heard of. If we have the token, this is its stamp.
+static token_stamp_t tokenTaken;                // Last token we accepted, so we can ignore resends of it
+static token_stamp_t tokenAck;                  // Token we owe an ack for
+
+static uint8_t tokenSendBitflags;               // A 1 means we have something new to tell the neighbor on this face
+static uint8_t tokenAckBitflags;                // A 1 means we owe the neighbor on this face an ack
+
+static unsigned long tokenRefreshTime;
+static unsigned long tokenNewsTime;             // Last time tokenNewest changed
+
+// True if a is newer than b. Generation and sequence can wrap around so we compare the difference.
+// If they are the same, the lower tile ID wins so two copies of a token can never both look newest.
+
+static bool token_newer( const token_stamp_t *a , const token_stamp_t *b ) {
+
+    if ( a->gen != b->gen ) {
+
+        return (int8_t) ( a->gen - b->gen ) > 0;
+
+    }
+
+    if ( a->seq != b->seq ) {
+
+        return (int16_t) ( a->seq - b->seq ) > 0;
+
+    }
+
+    return a->id < b->id;
+
+}
+
+static bool token_same( const token_stamp_t *a , const token_stamp_t *b ) {
+
+    return a->gen == b->gen && a->seq == b->seq && a->id == b->id;
+
+}
+
+static uint8_t *token_put_stamp( uint8_t *p , const token_stamp_t *s ) {
+
+    *p++ = s->gen;
+    *p++ = s->seq & 0xff;
+    *p++ = s->seq >> 8;
+    *p++ = s->id & 0xff;
+    *p++ = s->id >> 8;
+
+    return p;
+
+}
+
+static void token_get_stamp( const uint8_t *p , token_stamp_t *s ) {
+
+    s->gen = p[0];
+    s->seq = p[1] | ( p[2] << 8 );
+    s->id  = p[3] | ( p[4] << 8 );
+
+}
+
+// Tell all our neighbors what we know
+
+static void token_send_all() {
+
+    tokenSendBitflags = ALL_FACES_MASK;
+
+}
+
+// The token we have just moved (or is still alive). Give it a new stamp and tell everyone.
+
+static void token_bump() {
+
+    tokenNewest.seq++;
+    tokenNewest.id = getTileId();
+
+    tokenNewsTime = millis();
+
+    token_send_all();
+
+}
+
+static void token_pass( uint8_t face ) {
+
+    tokenOutFace = face;
+    tokenState = TOKEN_STATE_PASSING;
+
+    token_bump();
+
+}
+
+// We have the token and are done with it. Send it to the next tile in depth first order.
+
+static void token_next() {
+
+    uint8_t f = tokenInFace;
+
+    uint8_t parent = tree_parent_face();
+    uint8_t children = tree_child_bitflags();
+
+    if ( parent == TREE_NO_FACE ) {
+
+        // We are the root (or on our own for now). Children go in order from face 0 and when we
+        // run out the round is over.
+
+        f = ( f == TOKEN_NO_FACE ) ? 0 : f + 1;
+
+        while ( f < FACE_COUNT ) {          // WCET: 6 (FACE_COUNT)
+
+            if ( TBI( children , f ) ) {
+
+                token_pass( f );
+
+                return;
+
+            }
+
+            f++;
+
+        }
+
+        // Our turn again
+
+        tokenInFace = TOKEN_NO_FACE;
+        tokenState = TOKEN_STATE_HOLD;
+
+        token_bump();
+
+        return;
+
+    }
+
+    // Go clockwise from where it came in until we hit a child or get back around to our parent
+
+    if ( f == TOKEN_NO_FACE ) {
+
+        f = parent;
+
+    }
+
+    for( uint8_t i = 0 ; i < FACE_COUNT ; i++ ) {
+
+        f = clockwiseFace( f );
+
+        if ( TBI( children , f ) || f == parent ) {
+
+            break;
+
+        }
+
+    }
+
+    token_pass( f );
+
+}
+
+void token_loop_hook() {
+
+    if ( tokenState == TOKEN_STATE_PASSING && TBI( blinklib_frameState.expiredFaces , tokenOutFace ) ) {
+
+        // The tile we were passing to went away. Carry on as if it had given the token right back.
+
+        tokenInFace = tokenOutFace;
+
+        token_next();
+
+    }
+
+    if ( tokenRefreshTime <= millis() ) {
+
+        tokenRefreshTime = millis() + TOKEN_REFRESH_MS;
+
+        if ( tokenState == TOKEN_STATE_HOLD ) {
+
+            token_bump();       // Still alive
+
+        }
+
+        token_send_all();
+
+    }
+
+    if ( tree_is_root() && tokenNewsTime + TOKEN_LOST_MS <= millis() ) {
+
+        // Nobody has heard from the token in too long. Make a new one.
+
+        tokenNewest.gen++;
+        tokenNewest.seq = 0;
+
+        tokenInFace = TOKEN_NO_FACE;
+        tokenState = TOKEN_STATE_HOLD;
+
+        token_bump();
+
+    }
+
+}
+
+uint8_t token_tx_hook( uint8_t face , uint8_t *payload ) {
+
+    uint8_t *p = payload;
+
+    if ( TBI( tokenAckBitflags , face ) ) {
+
+        CBI( tokenAckBitflags , face );
+
+        *p++ = TOKEN_TYPE_ACK;
+
+        p = token_put_stamp( p , &tokenAck );
+
+    } else if ( tokenState == TOKEN_STATE_PASSING && face == tokenOutFace ) {
+
+        // Keep sending until they ack it
+
+        *p++ = TOKEN_TYPE_TOKEN;
+
+        p = token_put_stamp( p , &tokenNewest );
+
+    } else if ( TBI( tokenSendBitflags , face ) ) {
+
+        CBI( tokenSendBitflags , face );
+
+        *p++ = TOKEN_TYPE_NEWS;
+
+        p = token_put_stamp( p , &tokenNewest );
+
+    }
+
+    return p - payload;
+
+}
+
+void token_rx_hook( uint8_t face , const uint8_t *payload , uint8_t len ) {
+
+    if ( len < TOKEN_PAYLOAD_LEN ) {
+        return;
+    }
+
+    uint8_t type = payload[0];
+
+    token_stamp_t s;
+
+    token_get_stamp( payload + 1 , &s );
+
+    if ( type == TOKEN_TYPE_NEWS ) {
+
+        if ( token_newer( &s , &tokenNewest ) ) {
+
+            tokenNewest = s;
+            tokenNewsTime = millis();
+
+            // Whatever we had must be a stale copy
+
+            tokenState = TOKEN_STATE_NONE;
+
+            token_send_all();
+
+        }
+
+    } else if ( type == TOKEN_TYPE_TOKEN ) {
+
+        // Always ack, even a stale one, so the sender stops sending it
+
+        tokenAck = s;
+        SBI( tokenAckBitflags , face );
+
+        // The news might have beaten the token here, so the newest we know of is fine too
+
+        if ( !token_newer( &tokenNewest , &s ) && !token_same( &s , &tokenTaken ) ) {
+
+            tokenNewest = s;
+            tokenTaken = s;
+            tokenNewsTime = millis();
+
+            tokenInFace = face;
+
+            if ( face == tree_parent_face() ) {
+
+                tokenState = TOKEN_STATE_HOLD;
+
+                token_send_all();
+
+            } else {
+
+                // Coming back up from a child. Pass it right along.
+
+                token_next();
+
+            }
+
+        }
+
+    } else if ( type == TOKEN_TYPE_ACK ) {
+
+        if ( tokenState == TOKEN_STATE_PASSING && face == tokenOutFace && token_same( &s , &tokenNewest ) ) {
+
+            tokenState = TOKEN_STATE_NONE;
+
+        }
+
+    }
+
+}
+
+bool haveToken() {
+
+    return tokenState == TOKEN_STATE_HOLD;
+
+}
+
+void passToken() {
+
+    if ( tokenState == TOKEN_STATE_HOLD ) {
+
+        token_next();
+
+    }
+
+}
@@ -0,0 +1,246 @@
+/*
+ * tree.cpp
+ *
+ * A spanning tree over a connected group of tiles, for services that need to pass something around
+ * every tile once (token.cpp) or gather something up from every tile (vote.cpp).
+ *
+ * The tile with the lowest tile ID is the root, and every other tile picks the neighbor that is fewest
+ * hops from the root as its parent. Each tile tells its neighbors its root, its hops, and whether that neighbor
+ * is its parent, so everyone also knows who its children are.
+ *
+ * If a tile loses its parent, it tells the faces around it it has no root so any tiles below it drop out too,
+ * waits a moment for that to sink in, and then everyone rebuilds from whatever is left. Until then
+ * that tile acts as the root of its own little tree.
+ *
+ * Once our root, parent and children have stayed the same for TREE_STABLE_MS, we call the tree stable. That is
+ * long enough for every neighbor to have resent what it knows at least once, so a root that is still stable has
+ * heard from all its children.
+ *
+ * This is not a service the sketch calls directly. It gets linked in when a service that uses it is.
+ *
+ */
+
+#include "blinklib.h"
+
+#include "hooks.h"
+
+#define TREE_PAYLOAD_LEN        4       // Root ID low, root ID high, hops, flags
+
+#define TREE_FLAG_PARENT        0x01    // You are my parent
+
+#define TREE_NO_HOPS            0xff    // We have no root right now. Drop yours if you got it from us.
+#define TREE_MAX_HOPS             60    // Any farther than this is a stale path going around in circles
+
+#define TREE_REFRESH_MS         1000    // How often we resend on every face, to fill in for lost packets
+#define TREE_HOLDDOWN_MS        1000    // After losing our parent, wait this long for the tiles under us to drop out before rebuilding
+#define TREE_STABLE_MS          2000    // Nothing has changed for this long, so the tree is stable
+
+static word treeRootId = NO_TILE_ID;
+static uint8_t treeHops = TREE_NO_HOPS;
+static uint8_t treeParentFace;
+static uint8_t treeChildBitflags;               // A 1 means the neighbor on this face has told us we are its parent
+
+static uint8_t treeSendBitflags;                // A 1 means we have something new to tell the neighbor on this face
+
+static unsigned long treeRefreshTime;
+static unsigned long treeHoldTime;              // When the hold down is over
+static unsigned long treeChangeTime;            // Last time our root, parent or children changed
+
+// Tell all our neighbors what we know
+
+static void tree_send_all() {
+
+    treeSendBitflags = ALL_FACES_MASK;
+
+}
+
+static bool tree_has_parent() {
+
+    return treeHops != 0 && treeHops != TREE_NO_HOPS;
+
+}
+
+static void tree_set_children( uint8_t children ) {
+
+    if ( children != treeChildBitflags ) {
+
+        treeChildBitflags = children;
+
+        treeChangeTime = millis();
+
+    }
+
+}
+
+static void tree_drop_root() {
+
+    treeHops = TREE_NO_HOPS;
+    treeRootId = NO_TILE_ID;
+    treeChildBitflags = 0;
+
+    treeHoldTime = millis() + TREE_HOLDDOWN_MS;
+    treeChangeTime = millis();
+
+    tree_send_all();
+
+}
+
+void tree_loop_hook() {
+
+    uint8_t expired = blinklib_frameState.expiredFaces;
+
+    tree_set_children( treeChildBitflags & ~expired );
+
+    if ( tree_has_parent() && TBI( expired , treeParentFace ) ) {
+
+        // Lost our way to the root
+
+        tree_drop_root();
+
+    }
+
+    if ( treeHops == TREE_NO_HOPS && treeHoldTime <= millis() ) {
+
+        // Nobody better has come along, so be our own root until they do
+
+        treeRootId = getTileId();
+        treeHops = 0;
+
+        treeChangeTime = millis();
+
+        tree_send_all();
+
+    }
+
+    if ( treeRefreshTime <= millis() ) {
+
+        treeRefreshTime = millis() + TREE_REFRESH_MS;
+
+        tree_send_all();
+
+    }
+
+}
+
+uint8_t tree_tx_hook( uint8_t face , uint8_t *payload ) {
+
+    if ( !TBI( treeSendBitflags , face ) ) {
+
+        return 0;
+
+    }
+
+    CBI( treeSendBitflags , face );
+
+    payload[0] = treeRootId & 0xff;
+    payload[1] = treeRootId >> 8;
+    payload[2] = treeHops;
+    payload[3] = ( tree_has_parent() && face == treeParentFace ) ? TREE_FLAG_PARENT : 0;
+
+    return TREE_PAYLOAD_LEN;
+
+}
+
+void tree_rx_hook( uint8_t face , const uint8_t *payload , uint8_t len ) {
+
+    if ( len < TREE_PAYLOAD_LEN ) {
+        return;
+    }
+
+    uint8_t children = treeChildBitflags;
+
+    if ( payload[3] & TREE_FLAG_PARENT ) {
+
+        SBI( children , face );
+
+    } else {
+
+        CBI( children , face );
+
+    }
+
+    tree_set_children( children );
+
+    uint8_t theirHops = payload[2];
+
+    if ( theirHops == TREE_NO_HOPS ) {
+
+        if ( tree_has_parent() && face == treeParentFace ) {
+
+            tree_drop_root();
+
+        }
+
+        return;
+
+    }
+
+    if ( treeHops == TREE_NO_HOPS || theirHops >= TREE_MAX_HOPS ) {
+
+        // Still in hold down, or a path going around in circles
+
+        return;
+
+    }
+
+    word theirRootId = payload[0] | ( payload[1] << 8 );
+
+    uint8_t hops = theirHops + 1;
+
+    if ( theirRootId < treeRootId || ( theirRootId == treeRootId && ( hops < treeHops || ( face == treeParentFace && treeHops != 0 ) ) ) ) {
+
+        if ( theirRootId != treeRootId || hops != treeHops || face != treeParentFace ) {
+
+            if ( theirRootId != treeRootId || face != treeParentFace ) {
+
+                treeChangeTime = millis();
+
+            }
+
+            treeRootId = theirRootId;
+            treeHops = hops;
+            treeParentFace = face;
+
+            tree_send_all();
+
+        }
+
+    } else if ( theirRootId > treeRootId ) {
+
+        // They have not heard about our root yet
+
+        SBI( treeSendBitflags , face );
+
+    }
+
+}
+
+bool tree_is_root() {
+
+    return treeHops == 0;
+
+}
+
+uint8_t tree_parent_face() {
+
+    return tree_has_parent() ? treeParentFace : TREE_NO_FACE;
+
+}
+
+uint8_t tree_child_bitflags() {
+
+    return treeChildBitflags;
+
+}
+
+word tree_root_id() {
+
+    return treeRootId;
+
+}
+
+bool tree_is_stable() {
+
+    return treeHops != TREE_NO_HOPS && treeChangeTime + TREE_STABLE_MS <= millis();
+
+}
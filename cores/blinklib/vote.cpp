@@ -0,0 +1,277 @@
+/*
+ * vote.cpp
+ *
+ * Let a group of tiles agree on a value by vote, like which level to play next.
+ *
+ * Each tile votes for a value from 0 to VOTE_VALUE_COUNT-1. The votes are counted up the spanning tree
+ * from tree.cpp - each tile sends its parent how many tiles are below it (counting itself) and how many
+ * of them voted for each value. So the root ends up with the count for the whole group.
+ *
+ * Once every tile has voted, the root picks the value with the most votes (the lowest value wins a tie) and
+ * sends it back down the tree. Every tile takes the result from its parent, so they all end up with the
+ * same answer as the root.
+ *
+ * The root only decides once the tree is stable (see tree.cpp). While the tree is still forming, or a tile has
+ * lost its parent and is in hold down, a tile can look like a root with only part of the group under it. Results
+ * carry the root's ID, and a tile drops its result whenever its root changes, so a result from an old tree never
+ * sticks around in a new one.
+ *
+ * We only send when something changes (plus a resend now and then in case a packet got lost), so one vote
+ * changing costs one packet per tile on the way up to the root and one per tile on the way back down.
+ *
+ */
+
+#include <string.h>         // memset(), memcmp() and memcpy()
+
+#include "blinklib.h"
+
+#include "hooks.h"
+
+#define VOTE_TYPE_UP            1       // type, tiles below, count for each value
+#define VOTE_TYPE_DOWN          2       // type, result, root ID low, root ID high
+
+#define VOTE_TALLY_LEN          ( 1 + VOTE_VALUE_COUNT )    // tiles below, then count for each value
+
+#define VOTE_REFRESH_MS      1000       // How often we resend, to fill in for lost packets
+
+static uint8_t voteMine = NO_VOTE;
+static uint8_t voteResult = NO_VOTE;
+
+static uint8_t voteChildTally[FACE_COUNT][VOTE_TALLY_LEN];     // Last tally each child sent us
+static uint8_t voteSentTally[VOTE_TALLY_LEN];                  // Last tally we sent our parent
+
+static uint8_t voteLastParentFace = TREE_NO_FACE;
+static uint8_t voteLastChildBitflags;
+static word voteLastRootId = NO_TILE_ID;
+static bool voteStableFlag;
+
+static uint8_t voteDirtyFlag;                   // Something our tally depends on changed
+
+static uint8_t voteUpFlag;                      // Our tally changed, send it to our parent
+static uint8_t voteDownBitflags;                // A 1 means the child on this face needs the result
+
+static unsigned long voteRefreshTime;
+
+static void vote_set_result( uint8_t result ) {
+
+    if ( result != voteResult ) {
+
+        voteResult = result;
+
+        voteDownBitflags = ALL_FACES_MASK;
+
+    }
+
+}
+
+void vote_loop_hook() {
+
+    uint8_t parent = tree_parent_face();
+    uint8_t children = tree_child_bitflags();
+    word root = tree_root_id();
+    bool stable = tree_is_stable();
+
+    if ( root != voteLastRootId ) {
+
+        // Whatever the old root decided does not count in this tree
+
+        voteLastRootId = root;
+
+        vote_set_result( NO_VOTE );
+
+        voteDirtyFlag = 1;
+
+    }
+
+    if ( children != voteLastChildBitflags ) {
+
+        // New children need to hear the result
+
+        voteDownBitflags |= children & ~voteLastChildBitflags;
+
+        voteLastChildBitflags = children;
+
+        voteDirtyFlag = 1;
+
+    }
+
+    if ( parent != voteLastParentFace ) {
+
+        voteLastParentFace = parent;
+
+        voteUpFlag = 1;
+        voteDirtyFlag = 1;
+
+    }
+
+    if ( stable != voteStableFlag ) {
+
+        voteStableFlag = stable;
+
+        voteDirtyFlag = 1;
+
+    }
+
+    if ( voteRefreshTime <= millis() ) {
+
+        voteRefreshTime = millis() + VOTE_REFRESH_MS;
+
+        voteDownBitflags = ALL_FACES_MASK;
+        voteUpFlag = 1;
+
+    }
+
+    if ( !voteDirtyFlag ) {
+
+        return;
+
+    }
+
+    voteDirtyFlag = 0;
+
+    // Add up ourselves and everyone below us
+
+    uint8_t tally[VOTE_TALLY_LEN];
+
+    memset( tally , 0 , VOTE_TALLY_LEN );
+
+    tally[0] = 1;
+
+    if ( voteMine != NO_VOTE ) {
+
+        tally[ 1 + voteMine ]++;
+
+    }
+
+    FOREACH_FACE(f) {
+
+        if ( TBI( children , f ) ) {
+
+            for( uint8_t i = 0 ; i < VOTE_TALLY_LEN ; i++ ) {
+
+                tally[i] += voteChildTally[f][i];
+
+            }
+
+        }
+
+    }
+
+    if ( parent == TREE_NO_FACE ) {
+
+        // We are the root, so we decide. Nobody wins until everyone has voted, and we do not
+        // know who everyone is until the tree is stable.
+
+        if ( stable ) {
+
+            uint8_t voted = 0;
+            uint8_t best = 0;
+
+            for( uint8_t v = 0 ; v < VOTE_VALUE_COUNT ; v++ ) {
+
+                uint8_t count = tally[ 1 + v ];
+
+                voted += count;
+
+                if ( count > tally[ 1 + best ] ) {
+
+                    best = v;
+
+                }
+
+            }
+
+            vote_set_result( voted == tally[0] ? best : NO_VOTE );
+
+        }
+
+    } else if ( memcmp( tally , voteSentTally , VOTE_TALLY_LEN ) ) {
+
+        voteUpFlag = 1;
+
+    }
+
+    memcpy( voteSentTally , tally , VOTE_TALLY_LEN );
+
+}
+
+uint8_t vote_tx_hook( uint8_t face , uint8_t *payload ) {
+
+    if ( voteUpFlag && face == voteLastParentFace ) {
+
+        voteUpFlag = 0;
+
+        payload[0] = VOTE_TYPE_UP;
+
+        memcpy( payload + 1 , voteSentTally , VOTE_TALLY_LEN );
+
+        return 1 + VOTE_TALLY_LEN;
+
+    }
+
+    if ( TBI( voteDownBitflags , face ) && TBI( voteLastChildBitflags , face ) ) {
+
+        CBI( voteDownBitflags , face );
+
+        payload[0] = VOTE_TYPE_DOWN;
+        payload[1] = voteResult;
+        payload[2] = voteLastRootId & 0xff;
+        payload[3] = voteLastRootId >> 8;
+
+        return 4;
+
+    }
+
+    return 0;
+
+}
+
+void vote_rx_hook( uint8_t face , const uint8_t *payload , uint8_t len ) {
+
+    if ( len < 1 ) {
+        return;
+    }
+
+    if ( payload[0] == VOTE_TYPE_UP && len >= 1 + VOTE_TALLY_LEN ) {
+
+        if ( memcmp( voteChildTally[face] , payload + 1 , VOTE_TALLY_LEN ) ) {
+
+            memcpy( voteChildTally[face] , payload + 1 , VOTE_TALLY_LEN );
+
+            voteDirtyFlag = 1;
+
+        }
+
+    } else if ( payload[0] == VOTE_TYPE_DOWN && len >= 4 && face == tree_parent_face() ) {
+
+        // Only from our own root. Our parent might not have heard that the root changed yet.
+
+        if ( ( payload[2] | ( payload[3] << 8 ) ) == tree_root_id() ) {
+
+            vote_set_result( payload[1] );
+
+        }
+
+    }
+
+}
+
+void castVote( byte value ) {
+
+    uint8_t vote = value < VOTE_VALUE_COUNT ? value : NO_VOTE;
+
+    if ( vote != voteMine ) {
+
+        voteMine = vote;
+
+        voteDirtyFlag = 1;
+
+    }
+
+}
+
+byte getVoteResult() {
+
+    return voteResult;
+
+}
@@ -0,0 +1,324 @@
+/*
+ * IR Goodput Meter
+ *
+ * Measures how much useful data a datagram link really moves. Use this to check any change to how
+ * blinklib schedules IR sends.
+ *
+ * NOTE: This sketch is only interesting if you have a Blinks Dev Candy adapter connecting
+ * the blink to your serial port! The other tile must be running J-IRGoodputEcho.
+ *
+ * Put the two tiles together and click the button. We pick the first face with a neighbor and
+ * keep that link full of datagrams for TEST_TIME_MS at each length from 1 to IR_DATAGRAM_LEN bytes.
+ * The echo tile sends each one straight back, and as soon as we see it we send the next one, so
+ * there is a datagram going each way on every turn of the ping pong.
+ *
+ * At the end of each length we print one line of JSON on the service port...
+ *
+ *   {"len": 16, "sent": 812, "echoed": 810, "lost": 2, "corrupt": 0, "goodput_Bps": 2592, "p50_us": 5120, "p90_us": 5376, "p99_us": 6400, "max_us": 6912}
+ *
+ *   sent        - Datagrams we sent
+ *   echoed      - Came back to us intact
+ *   lost        - Did not come back within ECHO_TIMEOUT_MS
+ *   corrupt     - Came back with the wrong bytes in it
+ *   goodput_Bps - Payload bytes per second that made it across, counted in each direction
+ *   p50_us...   - Round trip time from when loop() sent the datagram to the start of the pass that
+ *                 picked up the echo. This counts the time the echo sat waiting for loop() to come back
+ *                 around, and since every echo picked up in the same pass gets the same time, the numbers
+ *                 only move in steps of about one pass. Percentiles are also rounded up to LATENCY_BIN_US.
+ *
+ * ...and {"done": 1} when every length has been run. Click again to start over.
+ *
+ * Each face shows:
+ *   BLUE   - Neighbor, ready to test
+ *   GREEN  - Blinks as the datagrams go back and forth on the face being tested
+ *   RED    - A datagram came back wrong during this run
+ *   OFF    - No neighbor
+ *
+ */
+
+#include "Serial.h"
+
+ServicePortSerial sp;
+
+#define TEST_TIME_MS        5000    // How long we run each datagram length
+#define ECHO_TIMEOUT_MS      200    // Give up on an echo after this long and count it lost. Longer than TX_PROBE_TIME_MS
+                                    // so a lost packet does not leave the link idle until the next probe.
+
+#define LATENCY_BIN_US       256    // Width of each bucket in the round trip histogram
+#define LATENCY_BIN_COUNT     64    // Anything past the last bucket counts in the last bucket
+
+#define NO_TEST_FACE    FACE_COUNT
+
+byte testFace = NO_TEST_FACE;       // Face we are testing on, or NO_TEST_FACE when idle
+byte testLen;                       // Datagram length we are testing now
+
+byte seq;                           // First byte of the datagram we are waiting on
+bool waitingFlag;                   // Is there a datagram out that has not come back yet?
+unsigned long sentMicros;           // When we sent it
+
+Timer testTimer;                    // When we move on to the next length
+Timer echoTimer;                    // When we give up on the datagram we are waiting on
+
+unsigned sentCount;
+unsigned echoedCount;
+unsigned lostCount;
+unsigned corruptCount;
+
+bool corruptFlag;                   // Saw any corrupt datagram this run
+
+uint16_t latencyBins[ LATENCY_BIN_COUNT ];
+unsigned long latencyMax;
+
+// Every byte depends on the seq so we can tell if any of them got mixed up
+
+static byte patternByte( byte s , byte i ) {
+
+  return s + ( i * 73 );
+
+}
+
+static void printField( const __FlashStringHelper *name , unsigned long value ) {
+
+  sp.print( F(", \"") );
+  sp.print( name );
+  sp.print( F("\": ") );
+  sp.print( value );
+
+}
+
+// Smallest round trip that at least pct percent of the echoes came back within
+
+static unsigned long latencyPercentile( byte pct ) {
+
+  unsigned long target = ( (unsigned long) echoedCount * pct + 99 ) / 100;
+  unsigned long total = 0;
+
+  for( byte b = 0 ; b < LATENCY_BIN_COUNT - 1 ; b++ ) {
+
+    total += latencyBins[b];
+
+    if ( total >= target ) {
+
+      unsigned long top = ( b + 1 ) * (unsigned long) LATENCY_BIN_US;
+
+      return top < latencyMax ? top : latencyMax;
+
+    }
+
+  }
+
+  return latencyMax;
+
+}
+
+static void startLen( byte len ) {
+
+  testLen = len;
+
+  sentCount = 0;
+  echoedCount = 0;
+  lostCount = 0;
+  corruptCount = 0;
+
+  memset( latencyBins , 0 , sizeof( latencyBins ) );
+  latencyMax = 0;
+
+  waitingFlag = false;
+
+  testTimer.set( TEST_TIME_MS );
+
+}
+
+static void reportLen() {
+
+  sp.print( F("{\"len\": ") );
+  sp.print( testLen );
+  printField( F("sent") , sentCount );
+  printField( F("echoed") , echoedCount );
+  printField( F("lost") , lostCount );
+  printField( F("corrupt") , corruptCount );
+  printField( F("goodput_Bps") , (unsigned long) echoedCount * testLen * 1000 / TEST_TIME_MS );
+  printField( F("p50_us") , latencyPercentile( 50 ) );
+  printField( F("p90_us") , latencyPercentile( 90 ) );
+  printField( F("p99_us") , latencyPercentile( 99 ) );
+  printField( F("max_us") , latencyMax );
+  sp.println( F("}") );
+
+}
+
+static void startTest() {
+
+  FOREACH_FACE(f) {
+
+    if ( !isValueReceivedOnFaceExpired( f ) ) {
+
+      testFace = f;
+      corruptFlag = false;
+
+      sp.print( F("{\"face\": ") );
+      sp.print( f );
+      printField( F("test_ms") , TEST_TIME_MS );
+      printField( F("max_len") , IR_DATAGRAM_LEN );
+      sp.println( F("}") );
+
+      startLen( 1 );
+
+      return;
+
+    }
+
+  }
+
+  sp.println( F("{\"error\": \"no neighbor\"}") );
+
+}
+
+static void checkEcho() {
+
+  const byte *data = getDatagramOnFace( testFace );
+
+  if ( !waitingFlag || getDatagramLengthOnFace( testFace ) != testLen || data[0] != seq ) {
+
+    // Late echo of something we already gave up on
+
+    return;
+
+  }
+
+  waitingFlag = false;
+
+  for( byte i = 1 ; i < testLen ; i++ ) {
+
+    if ( data[i] != patternByte( seq , i ) ) {
+
+      corruptCount++;
+      corruptFlag = true;
+
+      return;
+
+    }
+
+  }
+
+  echoedCount++;
+
+  unsigned long latency = getDatagramTimeOnFace( testFace ) - sentMicros;
+
+  if ( latency > latencyMax ) {
+
+    latencyMax = latency;
+
+  }
+
+  unsigned long bin = latency / LATENCY_BIN_US;
+
+  latencyBins[ bin < LATENCY_BIN_COUNT ? bin : LATENCY_BIN_COUNT - 1 ]++;
+
+}
+
+static void sendNext() {
+
+  byte data[ IR_DATAGRAM_LEN ];
+
+  seq++;
+
+  data[0] = seq;
+
+  for( byte i = 1 ; i < testLen ; i++ ) {
+
+    data[i] = patternByte( seq , i );
+
+  }
+
+  sendDatagramOnFace( data , testLen , testFace );
+
+  sentMicros = micros();
+  sentCount++;
+
+  waitingFlag = true;
+  echoTimer.set( ECHO_TIMEOUT_MS );
+
+}
+
+void setup() {
+
+  sp.begin();
+
+}
+
+void loop() {
+
+  if ( testFace == NO_TEST_FACE ) {
+
+    if ( buttonSingleClicked() ) {
+
+      startTest();
+
+    }
+
+  } else {
+
+    if ( isDatagramReadyOnFace( testFace ) ) {
+
+      checkEcho();
+
+      markDatagramReadOnFace( testFace );
+
+    }
+
+    if ( waitingFlag && echoTimer.isExpired() ) {
+
+      lostCount++;
+      waitingFlag = false;
+
+    }
+
+    if ( testTimer.isExpired() ) {
+
+      // Anything still out when the time is up is not counted either way
+
+      reportLen();
+
+      if ( testLen < IR_DATAGRAM_LEN ) {
+
+        startLen( testLen + 1 );
+
+      } else {
+
+        sp.println( F("{\"done\": 1}") );
+
+        testFace = NO_TEST_FACE;
+
+      }
+
+    } else if ( !waitingFlag ) {
+
+      sendNext();
+
+    }
+
+  }
+
+  FOREACH_FACE(f) {
+
+    if ( isValueReceivedOnFaceExpired( f ) ) {
+
+      setColorOnFace( OFF , f );
+
+    } else if ( corruptFlag ) {
+
+      setColorOnFace( RED , f );
+
+    } else if ( f == testFace ) {
+
+      setColorOnFace( dim( GREEN , ( seq & 0x01 ) ? 255 : 127 ) , f );
+
+    } else {
+
+      setColorOnFace( dim( BLUE , 128 ) , f );
+
+    }
+
+  }
+
+}
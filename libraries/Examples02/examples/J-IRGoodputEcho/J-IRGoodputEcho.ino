@@ -0,0 +1,56 @@
+/*
+ * IR Goodput Echo
+ *
+ * The other half of I-IRGoodputMeter. Every datagram we get on a face goes right back out the same
+ * face, unchanged, as fast as we can.
+ *
+ * Each face shows:
+ *   GREEN  - Echoed a datagram recently
+ *   BLUE   - Neighbor, but nothing to echo
+ *   OFF    - No neighbor
+ *
+ */
+
+// Keep showing green this long after the last echo
+
+#define SHOW_ECHO_TIME_MS   100
+
+Timer echoShowTimer[ FACE_COUNT ];
+
+void setup() {
+  // Blank
+}
+
+void loop() {
+
+  FOREACH_FACE(f) {
+
+    if ( isDatagramReadyOnFace( f ) ) {
+
+      // sendDatagramOnFace() copies the data, so we can free the buffer right after
+
+      sendDatagramOnFace( getDatagramOnFace( f ) , getDatagramLengthOnFace( f ) , f );
+
+      markDatagramReadOnFace( f );
+
+      echoShowTimer[f].set( SHOW_ECHO_TIME_MS );
+
+    }
+
+    if ( isValueReceivedOnFaceExpired( f ) ) {
+
+      setColorOnFace( OFF , f );
+
+    } else if ( !echoShowTimer[f].isExpired() ) {
+
+      setColorOnFace( GREEN , f );
+
+    } else {
+
+      setColorOnFace( dim( BLUE , 128 ) , f );
+
+    }
+
+  }
+
+}
@@ -0,0 +1,240 @@
+/*
+
+  NOTE: This sketch is only interesting if you have a Blinks Dev Candy adapter connecting
+  the blink to your serial port!
+
+  Compares fixed point math from fixed.h against float doing the same thing - a little
+  bit of physics where a ball bounces around with gravity and friction, and then a divide
+  on its own since that is the slowest thing you can do with any of them.
+
+  Each test runs the same step ITERATIONS times and prints about how many CPU cycles one step took
+  (the display interrupt steals a few percent, the same for each test),
+  along with the final position so you can see the answers match (close enough).
+
+  To compare flash usage, compile once as is and note the program size the IDE reports, then
+  comment out the `#define TEST_FLOAT` line below and compile again. The difference is what
+  float costs you. Do the same with `TEST_FIXED` to see what fixed point costs.
+
+  Results so far, from tools/hostsim...
+
+    fix8_8    y=3.61    divide q=75.00
+    fix16_16  y=0.45    divide q=75.00
+    float     y=2.41    divide q=75.00
+
+  The bounce ends up in a different place with each type because each one rounds a little differently
+  on every step, and the divide settles on the same answer for all three. The simulator runs the math on
+  a PC with its clock stopped inside loop(), so it prints cycles/step=0. It says nothing about cycles or
+  flash on a tile. Nobody has measured those yet, so if you run this on a tile, please put the numbers here.
+
+*/
+
+#define TEST_FIXED
+#define TEST_FLOAT
+
+#include "Serial.h"
+#include "fixed.h"
+
+#include <avr/interrupt.h>                       // cli() and sei() so we can read the multibyte clock safely
+#include "shared/blinkbios_shared_millis.h"      // For a clock that keeps ticking while we are inside loop()
+
+ServicePortSerial sp;
+
+#define ITERATIONS 1000
+
+// millis() only changes between passes though loop(), so we read the BIOS clock directly.
+// It ticks every 8us, which is 64 cycles at 8Mhz.
+
+#define CYCLES_PER_TICK 64UL
+
+unsigned long ticksNow() {
+
+  cli();
+  unsigned long ms = blinkbios_millis_block.millis;
+  byte steps = blinkbios_millis_block.step_8us;
+  sei();
+
+  return ( ms * 125 ) + steps;
+
+}
+
+// `volatile` so the compiler can not work out the answer at compile time and skip the work
+
+volatile int startHeight = 100;
+
+void printResult( const __FlashStringHelper *name , unsigned long ticks ) {
+
+  sp.print( name );
+  sp.print( F(" cycles/step=") );
+  sp.print( ( ticks * CYCLES_PER_TICK ) / ITERATIONS );
+
+}
+
+#ifdef TEST_FIXED
+
+void testFixed() {
+
+  fix8_8 y = startHeight;
+  fix8_8 v = 0;
+
+  const fix8_8 gravity  = fix8_8( -0.5 );
+  const fix8_8 friction = fix8_8( 0.98 );
+
+  unsigned long start = ticksNow();
+
+  for( int i = 0 ; i < ITERATIONS ; i++ ) {
+
+    v += gravity;
+    v *= friction;
+    y += v;
+
+    if ( y < 0 ) {
+      y = -y;
+      v = -v;
+    }
+
+  }
+
+  printResult( F("fix8_8") , ticksNow() - start );
+
+  sp.print( F(" y=") );
+  sp.println( y );
+
+  // Settles at 75
+
+  const fix8_8 divisor = fix8_8( 3 );
+  const fix8_8 offset = fix8_8( 50 );
+
+  fix8_8 q = startHeight;
+
+  start = ticksNow();
+
+  for( int i = 0 ; i < ITERATIONS ; i++ ) {
+
+    q = ( q / divisor ) + offset;
+
+  }
+
+  printResult( F("fix8_8 divide") , ticksNow() - start );
+
+  sp.print( F(" q=") );
+  sp.println( q );
+
+  fix16_16 y32 = startHeight;
+  fix16_16 v32 = 0;
+
+  const fix16_16 gravity32  = fix16_16( -0.5 );
+  const fix16_16 friction32 = fix16_16( 0.98 );
+
+  start = ticksNow();
+
+  for( int i = 0 ; i < ITERATIONS ; i++ ) {
+
+    v32 += gravity32;
+    v32 *= friction32;
+    y32 += v32;
+
+    if ( y32 < 0 ) {
+      y32 = -y32;
+      v32 = -v32;
+    }
+
+  }
+
+  printResult( F("fix16_16") , ticksNow() - start );
+
+  sp.print( F(" y=") );
+  sp.println( y32 );
+
+  const fix16_16 divisor32 = fix16_16( 3 );
+  const fix16_16 offset32 = fix16_16( 50 );
+
+  fix16_16 q32 = startHeight;
+
+  start = ticksNow();
+
+  for( int i = 0 ; i < ITERATIONS ; i++ ) {
+
+    q32 = ( q32 / divisor32 ) + offset32;
+
+  }
+
+  printResult( F("fix16_16 divide") , ticksNow() - start );
+
+  sp.print( F(" q=") );
+  sp.println( q32 );
+
+}
+
+#endif
+
+#ifdef TEST_FLOAT
+
+void testFloat() {
+
+  float y = startHeight;
+  float v = 0;
+
+  const float gravity  = -0.5;
+  const float friction = 0.98;
+
+  unsigned long start = ticksNow();
+
+  for( int i = 0 ; i < ITERATIONS ; i++ ) {
+
+    v += gravity;
+    v *= friction;
+    y += v;
+
+    if ( y < 0 ) {
+      y = -y;
+      v = -v;
+    }
+
+  }
+
+  printResult( F("float") , ticksNow() - start );
+
+  sp.print( F(" y=") );
+  sp.println( y );
+
+  const float divisor = 3;
+  const float offset = 50;
+
+  float q = startHeight;
+
+  start = ticksNow();
+
+  for( int i = 0 ; i < ITERATIONS ; i++ ) {
+
+    q = ( q / divisor ) + offset;
+
+  }
+
+  printResult( F("float divide") , ticksNow() - start );
+
+  sp.print( F(" q=") );
+  sp.println( q );
+
+}
+
+#endif
+
+void setup() {
+
+  sp.begin();
+
+}
+
+void loop() {
+
+  #ifdef TEST_FIXED
+    testFixed();
+  #endif
+
+  #ifdef TEST_FLOAT
+    testFloat();
+  #endif
+
+  sp.println();
+
+}
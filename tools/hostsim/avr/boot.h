@@ -0,0 +1,16 @@
+/*
+ * avr/boot.h for host builds
+ *
+ * Flash is read only on the host, so the simulated BIOS throws away page writes and filling the
+ * page buffer does nothing.
+ *
+ */
+
+#ifndef HOSTSIM_AVR_BOOT_H_
+#define HOSTSIM_AVR_BOOT_H_
+
+#include <avr/io.h>
+
+#define boot_page_fill(address,data)
+
+#endif /* HOSTSIM_AVR_BOOT_H_ */
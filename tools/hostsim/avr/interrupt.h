@@ -0,0 +1,19 @@
+/*
+ * avr/interrupt.h for host builds
+ *
+ * There are no real interrupts on the host. The simulated BIOS does its background work at the top of
+ * each pass and from the coverage callback, so cli() and sei() have nothing to protect against.
+ *
+ */
+
+#ifndef HOSTSIM_AVR_INTERRUPT_H_
+#define HOSTSIM_AVR_INTERRUPT_H_
+
+#include <avr/io.h>
+
+#define cli()
+#define sei()
+
+#define ISR(vector) extern "C" void vector(void)
+
+#endif /* HOSTSIM_AVR_INTERRUPT_H_ */
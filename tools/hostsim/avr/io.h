@@ -0,0 +1,52 @@
+/*
+ * avr/io.h for host builds
+ *
+ * Just enough of the ATmega168PB registers for the blinklib core to compile on a PC. They are plain
+ * variables defined in hostbios.cpp, so the core can read and write them and the simulated BIOS can look.
+ *
+ */
+
+#ifndef HOSTSIM_AVR_IO_H_
+#define HOSTSIM_AVR_IO_H_
+
+#include <stdint.h>
+
+extern volatile uint8_t WDTCSR , SREG , PRR , SPMCSR;
+extern volatile uint8_t ADMUX , ADCSRA , ADCL , ADCH;
+extern volatile uint8_t UCSR0A , UCSR0B , UCSR0C , UDR0;
+
+extern volatile uint16_t ADC , UBRR0;
+
+#define ADCW ADC
+
+#define _BV(b) (1<<(b))
+
+#define WDIE    6
+#define WDE     3
+
+#define U2X0    1
+#define TXEN0   3
+#define RXEN0   4
+#define UDRE0   5
+#define TXC0    6
+#define RXC0    7
+
+#define MUX0    0
+#define MUX1    1
+#define MUX2    2
+#define MUX3    3
+#define REFS0   6
+#define REFS1   7
+
+#define ADPS0   0
+#define ADPS1   1
+#define ADPS2   2
+#define ADIF    4
+#define ADSC    6
+#define ADEN    7
+
+#define PRADC   0
+
+#define SPM_PAGESIZE 128
+
+#endif /* HOSTSIM_AVR_IO_H_ */
@@ -0,0 +1,25 @@
+/*
+ * avr/pgmspace.h for host builds
+ *
+ * Flash and RAM are the same address space on the host, so PROGMEM reads are just reads.
+ *
+ */
+
+#ifndef HOSTSIM_AVR_PGMSPACE_H_
+#define HOSTSIM_AVR_PGMSPACE_H_
+
+#include <stdint.h>
+#include <string.h>
+
+#define PROGMEM
+#define PGM_P const char *
+#define PSTR(s) (s)
+
+#define pgm_read_byte(p)    ( *(const uint8_t *)(p) )
+#define pgm_read_word(p)    ( *(const uint16_t *)(p) )
+#define pgm_read_dword(p)   ( *(const uint32_t *)(p) )
+
+#define memcpy_P    memcpy
+#define strlen_P    strlen
+
+#endif /* HOSTSIM_AVR_PGMSPACE_H_ */
@@ -0,0 +1,16 @@
+/*
+ * avr/sleep.h for host builds
+ *
+ */
+
+#ifndef HOSTSIM_AVR_SLEEP_H_
+#define HOSTSIM_AVR_SLEEP_H_
+
+#include <avr/io.h>
+
+#define set_sleep_mode(mode)
+#define sleep_enable()
+#define sleep_disable()
+#define sleep_cpu()
+
+#endif /* HOSTSIM_AVR_SLEEP_H_ */
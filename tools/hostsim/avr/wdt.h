@@ -0,0 +1,14 @@
+/*
+ * avr/wdt.h for host builds
+ *
+ */
+
+#ifndef HOSTSIM_AVR_WDT_H_
+#define HOSTSIM_AVR_WDT_H_
+
+#include <avr/io.h>
+
+#define wdt_disable()   ( WDTCSR = 0 )
+#define wdt_reset()
+
+#endif /* HOSTSIM_AVR_WDT_H_ */
@@ -0,0 +1,195 @@
+/*
+ * bench.cpp
+ *
+ * Run a sketch though a fixed script of neighbors coming and going, button presses, and datagrams,
+ * and print how many basic blocks each pass though loop() took. See README.md.
+ *
+ * The script is meant to look like someone playing with a small cluster for a bit. Every sketch gets the
+ * same script, so a sketch that ignores something (like datagrams) just does not pay for it.
+ *
+ */
+
+#include <stdio.h>
+
+#include "hostbios.h"
+
+#include "shared/blinkbios_shared_button.h"
+
+#define BENCH_END_MS            20000
+
+#define BENCH_EVENT_NEIGHBOR        1       // face, mode, value
+#define BENCH_EVENT_BUTTON          2       // bitflags, clickcount, down
+#define BENCH_EVENT_DATAGRAM        3       // face, first byte of payload
+
+struct bench_event_t {
+
+    unsigned long ms;
+    uint8_t type;
+    uint8_t a , b , c;
+
+};
+
+static const bench_event_t benchScript[] = {
+
+    // Start out alone for a bit
+
+    {  2000 , BENCH_EVENT_NEIGHBOR , 0 , HOSTBIOS_NEIGHBOR_MIRROR , 0 },
+    {  2000 , BENCH_EVENT_NEIGHBOR , 1 , HOSTBIOS_NEIGHBOR_MIRROR , 0 },
+    {  2000 , BENCH_EVENT_NEIGHBOR , 3 , HOSTBIOS_NEIGHBOR_MIRROR , 0 },
+
+    {  3000 , BENCH_EVENT_NEIGHBOR , 4 , HOSTBIOS_NEIGHBOR_VALUE , 1 },
+
+    // Single click
+
+    {  4000 , BENCH_EVENT_BUTTON , BUTTON_BITFLAG_PRESSED , 0 , 1 },
+    {  4100 , BENCH_EVENT_BUTTON , BUTTON_BITFLAG_RELEASED , 0 , 0 },
+    {  4400 , BENCH_EVENT_BUTTON , BUTTON_BITFLAG_SINGLECLICKED , 1 , 0 },
+
+    {  5000 , BENCH_EVENT_NEIGHBOR , 4 , HOSTBIOS_NEIGHBOR_VALUE , 2 },
+
+    // Double click
+
+    {  6000 , BENCH_EVENT_BUTTON , BUTTON_BITFLAG_PRESSED , 0 , 1 },
+    {  6100 , BENCH_EVENT_BUTTON , BUTTON_BITFLAG_RELEASED , 0 , 0 },
+    {  6200 , BENCH_EVENT_BUTTON , BUTTON_BITFLAG_PRESSED , 0 , 1 },
+    {  6300 , BENCH_EVENT_BUTTON , BUTTON_BITFLAG_RELEASED , 0 , 0 },
+    {  6600 , BENCH_EVENT_BUTTON , BUTTON_BITFLAG_DOUBLECLICKED , 2 , 0 },
+
+    {  7000 , BENCH_EVENT_DATAGRAM , 0 , 1 , 0 },
+    {  7000 , BENCH_EVENT_DATAGRAM , 3 , 2 , 0 },
+
+    // Long press. Let go well before the 3 second mark so we do not end up in seed mode.
+
+    {  8000 , BENCH_EVENT_BUTTON , BUTTON_BITFLAG_PRESSED , 0 , 1 },
+    {  9000 , BENCH_EVENT_BUTTON , BUTTON_BITFLAG_LONGPRESSED , 0 , 1 },
+    {  9000 , BENCH_EVENT_DATAGRAM , 4 , 3 , 0 },
+    {  9500 , BENCH_EVENT_BUTTON , BUTTON_BITFLAG_RELEASED , 0 , 0 },
+
+    // Triple click
+
+    { 10000 , BENCH_EVENT_BUTTON , BUTTON_BITFLAG_PRESSED , 0 , 1 },
+    { 10100 , BENCH_EVENT_BUTTON , BUTTON_BITFLAG_RELEASED , 0 , 0 },
+    { 10200 , BENCH_EVENT_BUTTON , BUTTON_BITFLAG_PRESSED , 0 , 1 },
+    { 10300 , BENCH_EVENT_BUTTON , BUTTON_BITFLAG_RELEASED , 0 , 0 },
+    { 10400 , BENCH_EVENT_BUTTON , BUTTON_BITFLAG_PRESSED , 0 , 1 },
+    { 10500 , BENCH_EVENT_BUTTON , BUTTON_BITFLAG_RELEASED , 0 , 0 },
+    { 10800 , BENCH_EVENT_BUTTON , BUTTON_BITFLAG_MULITCLICKED , 3 , 0 },
+
+    { 11000 , BENCH_EVENT_NEIGHBOR , 4 , HOSTBIOS_NEIGHBOR_VALUE , 3 },
+
+    // Rearrange the cluster
+
+    { 12000 , BENCH_EVENT_NEIGHBOR , 1 , HOSTBIOS_NEIGHBOR_NONE , 0 },
+    { 14000 , BENCH_EVENT_NEIGHBOR , 5 , HOSTBIOS_NEIGHBOR_MIRROR , 0 },
+
+    { 15000 , BENCH_EVENT_DATAGRAM , 5 , 4 , 0 },
+
+    { 16000 , BENCH_EVENT_BUTTON , BUTTON_BITFLAG_PRESSED , 0 , 1 },
+    { 16100 , BENCH_EVENT_BUTTON , BUTTON_BITFLAG_RELEASED , 0 , 0 },
+    { 16400 , BENCH_EVENT_BUTTON , BUTTON_BITFLAG_SINGLECLICKED , 1 , 0 },
+
+    { 17000 , BENCH_EVENT_NEIGHBOR , 4 , HOSTBIOS_NEIGHBOR_NONE , 0 },
+
+};
+
+#define BENCH_EVENT_COUNT ( sizeof( benchScript ) / sizeof( benchScript[0] ) )
+
+static bool benchDone[ BENCH_EVENT_COUNT ];
+
+static unsigned long benchPasses;          // Not counting the first, which has setup() in it
+static unsigned long benchSetupBlocks;
+static unsigned long long benchTotalBlocks;
+static unsigned long benchMaxBlocks;
+
+void hostbios_time_hook( unsigned long now ) {
+
+    if ( now >= BENCH_END_MS ) {
+
+        hostbios_stop();
+
+    }
+
+    for( unsigned i = 0 ; i < BENCH_EVENT_COUNT ; i++ ) {
+
+        const bench_event_t *e = &benchScript[i];
+
+        if ( benchDone[i] || e->ms > now ) {
+            continue;
+        }
+
+        benchDone[i] = true;
+
+        switch ( e->type ) {
+
+            case BENCH_EVENT_NEIGHBOR:
+
+                hostbios_set_neighbor( e->a , e->b , e->c );
+
+                break;
+
+            case BENCH_EVENT_BUTTON:
+
+                hostbios_button_event( e->a , e->b );
+                hostbios_button_down( e->c );
+
+                break;
+
+            case BENCH_EVENT_DATAGRAM: {
+
+                uint8_t payload[] = { e->b , 0x55 , 0xaa , (uint8_t) e->a };
+
+                hostbios_send_datagram( e->a , payload , sizeof( payload ) );
+
+                break;
+
+            }
+
+        }
+
+    }
+
+}
+
+void hostbios_pass_hook( unsigned long blocks ) {
+
+    static bool firstFlag = true;
+
+    if ( firstFlag ) {
+
+        firstFlag = false;
+
+        benchSetupBlocks = blocks;
+
+        return;
+
+    }
+
+    benchPasses++;
+    benchTotalBlocks += blocks;
+
+    if ( blocks > benchMaxBlocks ) {
+
+        benchMaxBlocks = blocks;
+
+    }
+
+}
+
+int main() {
+
+    static const char * const exitNames[] = { "stopped" , "abend" , "seed" , "asleep" };
+
+    uint8_t reason = hostbios_run();
+
+    printf( "{\"exit\": \"%s\", \"ms\": %lu, \"passes\": %lu, \"setup_blocks\": %lu, \"mean_blocks\": %.1f, \"max_blocks\": %lu}\n" ,
+        exitNames[reason] ,
+        hostbios_millis() ,
+        benchPasses ,
+        benchSetupBlocks ,
+        benchPasses ? (double) benchTotalBlocks / benchPasses : 0.0 ,
+        benchMaxBlocks
+    );
+
+    return reason == HOSTBIOS_EXIT_STOPPED ? 0 : 1;
+
+}
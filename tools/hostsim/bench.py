@@ -0,0 +1,122 @@
+#!/usr/bin/env python3
+"""
+bench.py - Loop cost regression check for the example games. See README.md.
+
+Builds each sketch against the simulated BIOS, runs it though the script in bench.cpp, and compares
+the basic blocks per pass with baseline.json. If arduino-cli and the Blinks board package are
+installed, it also compiles each sketch for a real tile and checks the flash and RAM it uses.
+
+Usage:
+    bench.py                    Check every sketch in libraries/Examples03 against the baseline
+    bench.py --update           Same, but save the results as the new baseline
+    bench.py Sketch.ino ...     Just these sketches
+
+Exits 1 if anything got worse by more than the tolerance.
+"""
+
+import argparse
+import glob
+import json
+import os
+import re
+import shutil
+import subprocess
+import sys
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+REPO = os.path.normpath(os.path.join(HERE, '..', '..'))
+
+BASELINE = os.path.join(HERE, 'baseline.json')
+
+FQBN = 'move38:avr:blink'
+
+# Smaller is better for all of these. Footprint is null if we could not measure it.
+
+METRICS = [ 'mean_blocks' , 'max_blocks' , 'setup_blocks' , 'flash' , 'ram' ]
+
+
+def run_bench(sketch):
+    name = os.path.splitext(os.path.basename(sketch))[0]
+    subprocess.run([ 'make' , '-s' , '-C' , HERE , 'SKETCH=' + os.path.abspath(sketch) ], check=True)
+    out = subprocess.run([ os.path.join(HERE, 'build', name, 'bench') ], stdout=subprocess.PIPE, universal_newlines=True)
+    return json.loads(out.stdout)
+
+
+def footprint(sketch):
+    # Same numbers the IDE prints after a build, from recipe.size.regex in platform.txt
+    if not shutil.which('arduino-cli'):
+        return None, None
+    out = subprocess.run([ 'arduino-cli' , 'compile' , '--fqbn' , FQBN , os.path.dirname(os.path.abspath(sketch)) ],
+                         stdout=subprocess.PIPE, stderr=subprocess.STDOUT, universal_newlines=True)
+    flash = re.search(r'Sketch uses (\d+) bytes', out.stdout)
+    ram = re.search(r'Global variables use (\d+) bytes', out.stdout)
+    if out.returncode or not flash or not ram:
+        sys.stderr.write(out.stdout)
+        return None, None
+    return int(flash.group(1)), int(ram.group(1))
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Loop cost regression check for the example games')
+    parser.add_argument('--update', action='store_true', help='save the results as the new baseline')
+    parser.add_argument('--tolerance', type=float, default=2.0, help='percent worse than the baseline before we complain (default 2)')
+    parser.add_argument('sketches', nargs='*', help='sketches to run (default is all of libraries/Examples03)')
+    args = parser.parse_args()
+
+    sketches = args.sketches or sorted(glob.glob(os.path.join(REPO, 'libraries', 'Examples03', 'examples', '*', '*.ino')))
+
+    baseline = {}
+    if os.path.exists(BASELINE):
+        with open(BASELINE) as f:
+            baseline = json.load(f)
+
+    results = {}
+    failed = False
+
+    print('%-12s %12s %12s %12s %8s %8s' % ( 'sketch' , 'mean blocks' , 'max blocks' , 'setup' , 'flash' , 'ram' ))
+
+    for sketch in sketches:
+        name = os.path.splitext(os.path.basename(sketch))[0]
+        r = run_bench(sketch)
+        r['flash'], r['ram'] = footprint(sketch)
+        results[name] = { m : r[m] for m in METRICS }
+
+        if r['exit'] != 'stopped':
+            print('%-12s did not finish the script (%s at %d ms)' % ( name , r['exit'] , r['ms'] ))
+            failed = True
+            continue
+
+        print('%-12s %12.1f %12d %12d %8s %8s' % ( name , r['mean_blocks'] , r['max_blocks'] , r['setup_blocks'] ,
+                                                 r['flash'] if r['flash'] is not None else '-' ,
+                                                 r['ram'] if r['ram'] is not None else '-' ))
+
+        old = baseline.get(name)
+        if not old:
+            continue
+        for m in METRICS:
+            if old.get(m) is None or r[m] is None:
+                continue
+            change = 100.0 * ( r[m] - old[m] ) / old[m] if old[m] else 0.0
+            if change > args.tolerance:
+                print('    %s went from %s to %s (+%.1f%%)' % ( m , old[m] , r[m] , change ))
+                failed = True
+            elif change < -args.tolerance:
+                print('    %s went from %s to %s (%.1f%%), consider --update' % ( m , old[m] , r[m] , change ))
+
+    if args.update:
+        for name, r in results.items():
+            # Keep the old footprint if we could not measure it this time
+            old = baseline.get(name, {})
+            baseline[name] = { m : r[m] if r[m] is not None else old.get(m) for m in METRICS }
+        with open(BASELINE, 'w') as f:
+            json.dump(baseline, f, indent=2, sort_keys=True)
+            f.write('\n')
+        print('Saved baseline to %s' % os.path.relpath(BASELINE, REPO))
+    elif failed:
+        print('Slower than the baseline. If that is expected, run again with --update.')
+
+    return 1 if failed and not args.update else 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
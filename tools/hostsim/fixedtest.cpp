@@ -0,0 +1,113 @@
+/*
+ * fixedtest.cpp
+ *
+ * Checks the edge cases of fixed.h and Print::printFixed() on the PC, where they are easy to get at.
+ * These are the spots where the math can quietly overflow or round wrong, which a game would only show
+ * as the odd glitch.
+ *
+ * Usage: make -C tools/hostsim test
+ *
+ * Prints each check that fails and exits with 1 if any did.
+ *
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "Print.h"
+#include "fixed.h"
+
+// Collects whatever gets printed so we can compare it
+
+class StringPrint : public Print {
+
+  public:
+
+    char buffer[40];
+    size_t len;
+
+    StringPrint() : len( 0 ) { buffer[0] = 0; }
+
+    size_t write( uint8_t c ) {
+
+        if ( len + 1 < sizeof( buffer ) ) {
+
+            buffer[ len++ ] = c;
+            buffer[ len ] = 0;
+
+        }
+
+        return 1;
+
+    }
+
+};
+
+static int failCount;
+
+static void checkRaw( const char *what , long got , long expected ) {
+
+    if ( got != expected ) {
+
+        printf( "%s: got raw %ld, expected %ld\n" , what , got , expected );
+        failCount++;
+
+    }
+
+}
+
+template< typename T , typename W , uint8_t F >
+static void checkPrint( const char *what , Fixed<T,W,F> x , int digits , const char *expected ) {
+
+    StringPrint p;
+
+    p.print( x , digits );
+
+    if ( strcmp( p.buffer , expected ) ) {
+
+        printf( "%s: printed \"%s\", expected \"%s\"\n" , what , p.buffer , expected );
+        failCount++;
+
+    }
+
+}
+
+int main() {
+
+    // Ratios whose parts are out of range but whose result is not
+
+    checkRaw( "fix8_8::fromRatio( 200 , 400 )" , fix8_8::fromRatio( 200 , 400 ).raw , 128 );
+    checkRaw( "fix8_8::fromRatio( -300 , 600 )" , fix8_8::fromRatio( -300 , 600 ).raw , -128 );
+    checkRaw( "fix16_16::fromRatio( 30000 , 60000 )" , fix16_16::fromRatio( 30000 , 60000 ).raw , 32768 );
+    checkRaw( "fix8_8::fromRatio( 1 , 3 )" , fix8_8::fromRatio( 1 , 3 ).raw , 85 );
+
+    // Ratios that really are out of range saturate
+
+    checkRaw( "fix8_8::fromRatio( 1000 , 2 )" , fix8_8::fromRatio( 1000 , 2 ).raw , 32767 );
+    checkRaw( "fix8_8::fromRatio( 1 , 0 )" , fix8_8::fromRatio( 1 , 0 ).raw , 32767 );
+    checkRaw( "fix8_8::fromRatio( -1 , 0 )" , fix8_8::fromRatio( -1 , 0 ).raw , -32768 );
+
+    // Dividing the smallest value by -1 does not fit and must saturate too
+
+    checkRaw( "fix8_8::minValue() / -1" , ( fix8_8::minValue() / -1 ).raw , 32767 );
+    checkRaw( "fix16_16::minValue() / -1" , ( fix16_16::minValue() / -1 ).raw , 2147483647L );
+    checkRaw( "fix8_8( 3 ) / 2" , ( fix8_8( 3 ) / 2 ).raw , 384 );
+    checkRaw( "fix8_8( 3 ) / 0" , ( fix8_8( 3 ) / 0 ).raw , 32767 );
+
+    // Printing rounds at the last digit printed
+
+    checkPrint( "1/256 to 3 digits" , fix8_8::fromRaw( 1 ) , 3 , "0.004" );
+    checkPrint( "1/256 to 2 digits" , fix8_8::fromRaw( 1 ) , 2 , "0.00" );
+    checkPrint( "511/256 to 2 digits" , fix8_8::fromRaw( 511 ) , 2 , "2.00" );
+    checkPrint( "12.34 to 2 digits" , fix8_8( 12.34 ) , 2 , "12.34" );
+    checkPrint( "-1.5 to 1 digit" , fix8_8( -1.5 ) , 1 , "-1.5" );
+    checkPrint( "0.5 to 0 digits" , fix16_16( 0.5 ) , 0 , "1" );
+    checkPrint( "1/65536 to 4 digits" , fix16_16::fromRaw( 1 ) , 4 , "0.0000" );
+    checkPrint( "1/65536 to 18 digits" , fix16_16::fromRaw( 1 ) , 18 , "0.000015258789062500" );
+    checkPrint( "largest fix16_16 to 4 digits" , fix16_16::maxValue() , 4 , "32768.0000" );
+
+    printf( "%s\n" , failCount ? "FAILED" : "passed" );
+
+    return failCount ? 1 : 0;
+
+}
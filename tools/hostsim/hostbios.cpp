@@ -0,0 +1,611 @@
+/*
+ * hostbios.cpp
+ *
+ * The simulated BIOS. See hostbios.h.
+ *
+ * Remember this file gets compiled WITHOUT -fsanitize-coverage so the time we spend in here does not get
+ * counted against the sketch.
+ *
+ */
+
+#include <avr/io.h>
+
+#include <limits.h>
+#include <setjmp.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "hostbios.h"
+#include "hostcore.h"
+
+#include "blinklib.h"
+
+#include "shared/blinkbios_shared_button.h"
+#include "shared/blinkbios_shared_millis.h"
+#include "shared/blinkbios_shared_pixel.h"
+#include "shared/blinkbios_shared_irdata.h"
+
+#include "shared/blinkbios_shared_functions.h"
+
+#define HOSTBIOS_PASS_MS            2           // Default for hostbios_pass_ms
+
+#define HOSTBIOS_ISR_BLOCKS       256           // Basic blocks between our "interrupts"
+#define HOSTBIOS_IDLE_BLOCKS   100000UL         // If the sketch goes this many blocks without a pass, move the clock along anyway
+
+#define HOSTBIOS_ADC_BANDGAP      375           // What the ADC reads for the 1.1V bandgap with a 3V battery
+
+#define HOSTBIOS_TIMER_COUNT       32           // How many Timers fast forward can keep track of each pass
+
+#define HOSTBIOS_NO_DEADLINE    ULONG_MAX
+
+#define HOSTBIOS_DATAGRAM_VALUE     0b00101010  // Must match DATAGRAM_SPECIAL_VALUE in blinklib.cpp
+
+#define HOSTBIOS_VERSION            1
+
+// Our stand ins for the AVR registers in avr/io.h
+
+volatile uint8_t WDTCSR , SREG , PRR , SPMCSR;
+volatile uint8_t ADMUX , ADCSRA , ADCL , ADCH;
+volatile uint8_t UCSR0A , UCSR0B , UCSR0C , UDR0;
+
+volatile uint16_t ADC , UBRR0;
+
+// Read by getSerialNumberByte(). Any fixed value will do.
+
+extern const byte hostbios_serial_number[ SERIAL_NUMBER_LEN ] = { 0x48 , 0x4f , 0x53 , 0x54 , 0x42 , 0x49 , 0x4f , 0x53 , 0x01 };
+
+uint8_t hostbios_pass_ms = HOSTBIOS_PASS_MS;
+
+// A packet waiting to show up in the IR RX buffer on a face
+
+struct hostbios_packet_t {
+
+    uint8_t len;                            // 0=nothing waiting
+    uint8_t data[ IR_RX_PACKET_SIZE ];
+
+};
+
+static uint8_t hostbiosNeighborMode[ IR_FACE_COUNT ];
+static uint8_t hostbiosNeighborValue[ IR_FACE_COUNT ];      // Value a HOSTBIOS_NEIGHBOR_VALUE neighbor sends, or the last face value a mirror sent back
+
+static hostbios_packet_t hostbiosReply[ IR_FACE_COUNT ];     // What the neighbor sends back after hearing from us
+static hostbios_packet_t hostbiosDatagram[ IR_FACE_COUNT ];  // Datagrams from the driver
+
+static unsigned long hostbiosWorldTime;         // Real world time. Same as millis() until the tile sleeps.
+
+static unsigned long hostbiosMaxStep;           // 0=fast forward off
+static unsigned long hostbiosWorldDeadline = HOSTBIOS_NO_DEADLINE;
+static unsigned long hostbiosMillisDeadline = HOSTBIOS_NO_DEADLINE;
+
+static const uint32_t *hostbiosTimers[ HOSTBIOS_TIMER_COUNT ];     // Timers the core or sketch looked at this pass
+static uint8_t hostbiosTimerCount;
+
+static bool hostbiosAsleep;
+
+static unsigned long hostbiosBlocks;
+static unsigned long hostbiosPassBlocks;        // hostbiosBlocks at the start of this pass
+static unsigned long hostbiosTickBlocks;        // hostbiosBlocks the last time the clock moved
+static uint16_t hostbiosIsrCountdown = HOSTBIOS_ISR_BLOCKS;
+
+static uint32_t hostbiosEntropy = 0x12345678;   // Same "random" bits every run
+
+static jmp_buf hostbiosExit;
+
+static void __attribute__((noreturn)) hostbios_exit( uint8_t reason ) {
+
+    longjmp( hostbiosExit , reason + 1 );
+
+}
+
+// Top bit is ODD parity over the other 7, just like irValueEncode() in blinklib.cpp
+
+static uint8_t hostbios_encode_value( uint8_t d ) {
+
+    uint8_t p = d ^ ( d >> 4 );
+
+    p ^= p >> 2;
+    p ^= p >> 1;
+
+    return ( p & 0x01 ) ? d : d | 0x80;
+
+}
+
+// Move any waiting packets into the RX buffers that are free. Driver datagrams go first.
+
+static void hostbios_deliver() {
+
+    for( uint8_t f = 0 ; f < IR_FACE_COUNT ; f++ ) {
+
+        ir_rx_state_t *ir_rx_state = &blinkbios_irdata_block.ir_rx_states[f];
+
+        if ( ir_rx_state->packetBufferReady ) {
+            continue;
+        }
+
+        hostbios_packet_t *packet = hostbiosDatagram[f].len ? &hostbiosDatagram[f] : &hostbiosReply[f];
+
+        if ( packet->len ) {
+
+            ir_rx_state->packetBuffer[0] = IR_USER_DATA_HEADER_BYTE;
+            memcpy( (uint8_t *) ir_rx_state->packetBuffer + 1 , packet->data , packet->len );
+            ir_rx_state->packetBufferLen = 1 + packet->len;
+            ir_rx_state->packetBufferReady = 1;
+
+            packet->len = 0;
+
+        }
+
+    }
+
+}
+
+// How far to move the clock. passFlag is true if the sketch is running passes though loop().
+
+static unsigned long hostbios_step( bool passFlag ) {
+
+    if ( !hostbiosMaxStep ) {
+
+        return hostbios_pass_ms;
+
+    }
+
+    if ( passFlag ) {
+
+        if ( !hostcore_deadlines() ) {
+
+            return hostbios_pass_ms;
+
+        }
+
+        for( uint8_t i = 0 ; i < hostbiosTimerCount ; i++ ) {
+
+            uint32_t expireTime = *hostbiosTimers[i];
+
+            if ( expireTime != MILLIS_NEVER ) {
+
+                hostbios_millis_deadline( expireTime + 1 );     // isExpired() is true once millis() is past expireTime
+
+            }
+
+        }
+
+    }
+
+    hostbiosTimerCount = 0;
+
+    unsigned long step = HOSTBIOS_NO_DEADLINE;
+
+    if ( !hostbiosAsleep ) {
+
+        hostbios_millis_deadline( blinkbios_millis_block.sleep_time + 1 );
+
+        step = hostbiosMillisDeadline - blinkbios_millis_block.millis;
+
+        if ( passFlag && step > hostbiosMaxStep ) {
+
+            step = hostbiosMaxStep;
+
+        }
+
+        for( uint8_t f = 0 ; f < IR_FACE_COUNT ; f++ ) {
+
+            if ( hostbiosReply[f].len || hostbiosDatagram[f].len ) {
+
+                // Something to deliver, so do not keep it waiting
+
+                step = hostbios_pass_ms;
+
+            }
+
+        }
+
+    }
+
+    if ( hostbiosWorldDeadline != HOSTBIOS_NO_DEADLINE && hostbiosWorldDeadline - hostbiosWorldTime < step ) {
+
+        step = hostbiosWorldDeadline - hostbiosWorldTime;
+
+    }
+
+    if ( step == HOSTBIOS_NO_DEADLINE ) {
+
+        // Asleep and nothing scripted to wake us
+
+        hostbios_exit( HOSTBIOS_EXIT_ASLEEP );
+
+    }
+
+    hostbiosWorldDeadline = HOSTBIOS_NO_DEADLINE;
+    hostbiosMillisDeadline = HOSTBIOS_NO_DEADLINE;
+
+    return step < hostbios_pass_ms ? hostbios_pass_ms : step;
+
+}
+
+// Move the clock along and see what the driver wants to happen now. If the tile is asleep, keep going until it wakes.
+
+static void hostbios_tick( bool passFlag ) {
+
+    do {
+
+        unsigned long step = hostbios_step( passFlag );
+
+        hostbiosWorldTime += step;
+
+        if ( !hostbiosAsleep ) {
+
+            blinkbios_millis_block.millis += step;
+
+            if ( blinkbios_millis_block.millis > blinkbios_millis_block.sleep_time ) {
+
+                hostbiosAsleep = true;
+
+            }
+
+        }
+
+        if ( hostbiosAsleep ) {
+
+            // A sleeping tile does not hear anything
+
+            memset( hostbiosReply , 0 , sizeof( hostbiosReply ) );
+            memset( hostbiosDatagram , 0 , sizeof( hostbiosDatagram ) );
+
+        }
+
+        hostbios_time_hook( hostbiosWorldTime );
+
+    } while ( hostbiosAsleep );
+
+    hostbios_deliver();
+
+    hostbiosTickBlocks = hostbiosBlocks;
+
+}
+
+// The things the real BIOS does from its timer and watchdog ISRs that a sketch might be waiting on
+
+static void hostbios_isr() {
+
+    if ( WDTCSR & _BV(WDIE) ) {
+
+        // randomize() takes the bottom bit of this each time it changes from 0
+
+        hostbiosEntropy ^= hostbiosEntropy << 13;
+        hostbiosEntropy ^= hostbiosEntropy >> 17;
+        hostbiosEntropy ^= hostbiosEntropy << 5;
+
+        blinkbios_pixel_block.capturedEntropy = 2 | ( hostbiosEntropy & 0x01 );
+
+    }
+
+    if ( ADCSRA & _BV(ADSC) ) {
+
+        ADC = HOSTBIOS_ADC_BANDGAP;
+
+        ADCSRA &= ~_BV(ADSC);       // Conversion done
+
+    }
+
+    if ( hostbiosBlocks - hostbiosTickBlocks > HOSTBIOS_IDLE_BLOCKS ) {
+
+        // Waiting on something without handing off frames (like in warm sleep), so time has to keep going
+
+        hostbios_tick( false );
+
+    }
+
+}
+
+// Called by the compiler at the start of every basic block in the core and sketch
+
+extern "C" void __sanitizer_cov_trace_pc() {
+
+    hostbiosBlocks++;
+
+    // The service port always has room, and we pick up each byte as soon as the sketch writes it
+
+    if ( UDR0 ) {
+
+        hostbios_serial_hook( UDR0 );
+
+        UDR0 = 0;
+
+    }
+
+    if ( --hostbiosIsrCountdown == 0 ) {
+
+        hostbiosIsrCountdown = HOSTBIOS_ISR_BLOCKS;
+
+        hostbios_isr();
+
+    }
+
+}
+
+// --- The BIOS vectors from shared/blinkbios_shared_functions.h
+
+uint8_t BLINKBIOS_IRDATA_SEND_PACKET_VECTOR( uint8_t face , const uint8_t *data , uint8_t len ) {
+
+    hostbios_packet_t *reply = &hostbiosReply[face];
+
+    switch ( hostbiosNeighborMode[face] ) {
+
+        case HOSTBIOS_NEIGHBOR_VALUE:
+
+            reply->data[0] = hostbios_encode_value( hostbiosNeighborValue[face] );
+            reply->len = 1;
+
+            break;
+
+        case HOSTBIOS_NEIGHBOR_MIRROR:
+
+            if ( len == 1 || ( len <= IR_RX_PACKET_SIZE && ( data[0] & 0b00111111 ) == HOSTBIOS_DATAGRAM_VALUE ) ) {
+
+                // Face values and datagrams come right back
+
+                memcpy( reply->data , data , len );
+                reply->len = len;
+
+                if ( len == 1 ) {
+
+                    hostbiosNeighborValue[face] = data[0] & 0b00111111;
+
+                }
+
+            } else {
+
+                // Anything else (like service packets) is not for a sketch to answer, so just send the last value
+
+                reply->data[0] = hostbios_encode_value( hostbiosNeighborValue[face] );
+                reply->len = 1;
+
+            }
+
+            break;
+
+    }
+
+    return 1;
+
+}
+
+void BLINKBIOS_DISPLAY_PIXEL_BUFFER_VECTOR() {
+
+    hostbios_pass_hook( hostbiosBlocks - hostbiosPassBlocks );
+
+    hostbios_tick( true );
+
+    hostbiosPassBlocks = hostbiosBlocks;
+
+}
+
+void BLINKBIOS_BOOTLOADER_SEED_VECTOR() {
+
+    hostbios_exit( HOSTBIOS_EXIT_SEED );
+
+}
+
+void BLINKBIOS_POSTPONE_SLEEP_VECTOR() {
+
+    blinkbios_millis_block.sleep_time = blinkbios_millis_block.millis + HOSTBIOS_SLEEP_TIMEOUT_MS;
+
+}
+
+void BLINKBIOS_SLEEP_NOW_VECTOR() {
+
+    hostbiosAsleep = true;
+
+    hostbios_tick( false );
+
+}
+
+void BLINKBIOS_WRITE_FLASH_PAGE_VECTOR( uint8_t /*page*/ ) {
+}
+
+uint8_t BLINKBIOS_VERSION_VECTOR() {
+
+    return HOSTBIOS_VERSION;
+
+}
+
+void BLINKBIOS_ABEND_VECTOR( uint8_t /*blinkCount*/ ) {
+
+    hostbios_exit( HOSTBIOS_EXIT_ABEND );
+
+}
+
+// --- Driver side
+
+// mainx() in main.cpp is where the real BIOS jumps to start the sketch. It never returns.
+
+extern "C" void mainx(void);
+
+uint8_t hostbios_run() {
+
+    int r = setjmp( hostbiosExit );
+
+    if ( r ) {
+
+        return r - 1;
+
+    }
+
+    blinkbios_button_block.wokeFlag = 1;
+
+    BLINKBIOS_POSTPONE_SLEEP_VECTOR();
+
+    UCSR0A = _BV( UDRE0 ) | _BV( TXC0 );
+
+    hostbiosPassBlocks = hostbiosBlocks;
+    hostbiosTickBlocks = hostbiosBlocks;
+
+    hostbios_time_hook( hostbiosWorldTime );
+
+    mainx();
+
+    return HOSTBIOS_EXIT_STOPPED;       // Never gets here
+
+}
+
+void hostbios_stop() {
+
+    hostbios_exit( HOSTBIOS_EXIT_STOPPED );
+
+}
+
+unsigned long hostbios_millis() {
+
+    return hostbiosWorldTime;
+
+}
+
+void hostbios_fast_forward( unsigned long maxStepMs ) {
+
+    hostbiosMaxStep = maxStepMs;
+
+}
+
+void hostbios_deadline( unsigned long ms ) {
+
+    if ( ms > hostbiosWorldTime && ms < hostbiosWorldDeadline ) {
+
+        hostbiosWorldDeadline = ms;
+
+    }
+
+}
+
+bool hostbios_asleep() {
+
+    return hostbiosAsleep;
+
+}
+
+void hostbios_millis_deadline( unsigned long ms ) {
+
+    if ( ms > blinkbios_millis_block.millis && ms < hostbiosMillisDeadline ) {
+
+        hostbiosMillisDeadline = ms;
+
+    }
+
+}
+
+// Timer.cpp calls this in place of millis() in host builds, so we know which Timers to look at before jumping ahead.
+// We keep the address rather than the value since the Timer might get set() right after.
+
+unsigned long hostbios_timer_millis( const uint32_t *expireTime ) {
+
+    uint8_t i = 0;
+
+    while ( i < hostbiosTimerCount && hostbiosTimers[i] != expireTime ) {
+
+        i++;
+
+    }
+
+    if ( i == hostbiosTimerCount && i < HOSTBIOS_TIMER_COUNT ) {
+
+        hostbiosTimers[ hostbiosTimerCount++ ] = expireTime;
+
+    }
+
+    return millis();
+
+}
+
+unsigned long hostbios_blocks() {
+
+    return hostbiosBlocks;
+
+}
+
+void hostbios_set_neighbor( uint8_t face , uint8_t mode , uint8_t value ) {
+
+    hostbiosNeighborMode[face] = mode;
+    hostbiosNeighborValue[face] = value;
+
+    hostbiosReply[face].len = 0;
+
+    if ( mode != HOSTBIOS_NEIGHBOR_NONE ) {
+
+        // Say hello so our tile knows we are here without waiting for its next probe
+
+        hostbiosReply[face].data[0] = hostbios_encode_value( value );
+        hostbiosReply[face].len = 1;
+
+    }
+
+}
+
+void hostbios_send_datagram( uint8_t face , const uint8_t *data , uint8_t len ) {
+
+    if ( len > IR_DATAGRAM_LEN ) {
+        return;
+    }
+
+    hostbios_packet_t *d = &hostbiosDatagram[face];
+
+    // Header, payload, then the inverted sum of the payload like computePacketChecksum()
+
+    uint8_t checksum = 0;
+
+    d->data[0] = hostbios_encode_value( HOSTBIOS_DATAGRAM_VALUE );
+
+    for( uint8_t i = 0 ; i < len ; i++ ) {
+
+        d->data[ 1 + i ] = data[i];
+
+        checksum += data[i];
+
+    }
+
+    d->data[ 1 + len ] = checksum ^ 0xff;
+    d->len = 1 + len + 1;
+
+}
+
+void hostbios_button_event( uint8_t bitflags , uint8_t clickcount ) {
+
+    if ( hostbiosAsleep && ( bitflags & BUTTON_BITFLAG_PRESSED ) ) {
+
+        // Waking up. Like the real BIOS, we let the sketch know by clearing wokeFlag.
+
+        hostbiosAsleep = false;
+
+        blinkbios_button_block.wokeFlag = 0;
+
+        BLINKBIOS_POSTPONE_SLEEP_VECTOR();
+
+    }
+
+    blinkbios_button_block.bitflags |= bitflags;
+
+    if ( clickcount ) {
+
+        blinkbios_button_block.clickcount = clickcount;
+
+    }
+
+}
+
+void hostbios_button_down( uint8_t down ) {
+
+    blinkbios_button_block.down = down;
+
+}
+
+// Default hooks do nothing, except the serial port goes to stderr
+
+void __attribute__((weak)) hostbios_time_hook( unsigned long /*now*/ ) {
+}
+
+void __attribute__((weak)) hostbios_pass_hook( unsigned long /*blocks*/ ) {
+}
+
+void __attribute__((weak)) hostbios_serial_hook( uint8_t c ) {
+
+    fputc( c , stderr );
+
+}
@@ -0,0 +1,117 @@
+/*
+ * hostbios.h
+ *
+ * A stand-in for the BlinkBIOS so a sketch and the blinklib core can run on a PC.
+ *
+ * On a tile the BIOS lives up in the bootloader and talks to blinklib though the shared memory blocks
+ * and the boot_vectorX functions in shared/blinkbios_shared_functions.h. Here we supply those same
+ * functions, and fill in the shared blocks the way the BIOS would...
+ *
+ *  - Time only moves when the sketch hands off a frame to the display (once per pass though loop()),
+ *    by hostbios_pass_ms each time. So a run does exactly the same thing every time.
+ *  - Each face can have nobody there, a neighbor that sends a fixed value, or a neighbor that mirrors
+ *    back whatever we send it (so it looks like a tile running the same sketch as us).
+ *  - The driver can press the button and send datagrams whenever it likes.
+ *
+ * Normally the clock moves a fixed step each pass, which is what you want for timing things. For long runs,
+ * hostbios_fast_forward() has it jump straight to the next time something is going to happen instead - the next
+ * time the core sends on a face or a face times out, the next Timer that comes due, the next thing the driver has
+ * scripted, or the BIOS putting the tile to sleep. Nothing happens in between, so skipping it does not change what
+ * the tile does, and hours of tile time go by in a blink.
+ *
+ * Like on a tile, the BIOS goes into a deep sleep if nobody postpones it for HOSTBIOS_SLEEP_TIMEOUT_MS, and only
+ * wakes on a button press. millis() does not move while asleep, so we keep the driver's "real world" time separately.
+ *
+ * The core and the sketch get compiled with -fsanitize-coverage=trace-pc, so we get a callback on every
+ * basic block. We count those as a stand in for CPU cycles, and also use the callback as our "interrupt"
+ * to do the background things the BIOS does from its ISRs (like the watchdog entropy for randomize()).
+ * This file must NOT be compiled with that flag or it would end up counting itself.
+ *
+ */
+
+#ifndef HOSTBIOS_H_
+#define HOSTBIOS_H_
+
+#include <stdint.h>
+
+#define HOSTBIOS_NEIGHBOR_NONE      0       // Nobody there
+#define HOSTBIOS_NEIGHBOR_VALUE     1       // Always sends the same face value
+#define HOSTBIOS_NEIGHBOR_MIRROR    2       // Sends back every face value and datagram we send it
+
+#define HOSTBIOS_EXIT_STOPPED       0       // Driver called hostbios_stop()
+#define HOSTBIOS_EXIT_ABEND         1       // Sketch called the abend vector (like when it blew the stack)
+#define HOSTBIOS_EXIT_SEED          2       // Sketch went into seed mode, which never comes back on a tile
+#define HOSTBIOS_EXIT_ASLEEP        3       // Fast forward with the tile asleep and nothing scripted to wake it
+
+#define HOSTBIOS_SLEEP_TIMEOUT_MS   ( 2 * 60 * 60 * 1000UL )    // BIOS goes into deep sleep after this long without being postponed
+
+extern uint8_t hostbios_pass_ms;                // How far the clock moves each pass. Default is HOSTBIOS_PASS_MS.
+
+// Run the sketch (setup() then loop() over and over) until something ends it.
+// Returns one of the HOSTBIOS_EXIT_ values.
+
+uint8_t hostbios_run();
+
+// End the run. Only call from inside one of the hooks below.
+
+void hostbios_stop();
+
+// Where we are in real world time. Unlike millis() on the tile, this keeps going while the tile is asleep.
+
+unsigned long hostbios_millis();
+
+// Jump to the next deadline rather than moving hostbios_pass_ms each pass. While the sketch is running we never
+// jump more than maxStepMs at a time, since the services keep their own deadlines where we can not see them.
+// 0 goes back to a fixed step each pass.
+
+void hostbios_fast_forward( unsigned long maxStepMs );
+
+// Do not let fast forward jump past this real world time. This only counts until the clock next moves,
+// so a driver should call it again from each hostbios_time_hook() for the next thing it has scripted.
+
+void hostbios_deadline( unsigned long ms );
+
+// True while the BIOS has the tile in deep sleep
+
+bool hostbios_asleep();
+
+// How many basic blocks the core and sketch have run so far
+
+unsigned long hostbios_blocks();
+
+void hostbios_set_neighbor( uint8_t face , uint8_t mode , uint8_t value );
+
+// The datagram shows up on the face once the last thing we got there has been read
+
+void hostbios_send_datagram( uint8_t face , const uint8_t *data , uint8_t len );
+
+// Button events show up just like the BIOS would set them, OR'ed into any that have not been picked up yet.
+// A press wakes the tile from deep sleep.
+
+void hostbios_button_event( uint8_t bitflags , uint8_t clickcount );
+
+void hostbios_button_down( uint8_t down );
+
+// The driver supplies these to script what happens and to look at each pass. The defaults do nothing unless noted.
+
+// Called each time the clock moves, before anything else happens at the new time
+
+void hostbios_time_hook( unsigned long now );
+
+// Called once for each pass though loop() with how many basic blocks it took
+
+void hostbios_pass_hook( unsigned long blocks );
+
+// Called with each byte the sketch sends out the service port. The default writes it to stderr, so
+// a sketch that prints does not get mixed in with a driver's results on stdout.
+
+void hostbios_serial_hook( uint8_t c );
+
+// Host builds of the core call these to tell fast forward about their deadlines (see hosttimer.cpp and hostcore.h).
+// Times are in millis(), so they stop while asleep.
+
+unsigned long hostbios_timer_millis( const uint32_t *expireTime );
+
+void hostbios_millis_deadline( unsigned long ms );
+
+#endif /* HOSTBIOS_H_ */
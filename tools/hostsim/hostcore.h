@@ -0,0 +1,21 @@
+/*
+ * hostcore.h
+ *
+ * What fast forward needs to see inside blinklib.cpp. The face timers there are static, so blinklib.cpp
+ * defines this itself in host builds (anything that is not __AVR__). A tile never builds it.
+ *
+ */
+
+#ifndef HOSTCORE_H_
+#define HOSTCORE_H_
+
+#include "hostbios.h"
+
+// Called from the display vector, so TX_IRFaces() has not run yet this pass. Tells fast forward (with
+// hostbios_millis_deadline()) the next time the core will send on a face, time out a face, or sample link quality.
+// Returns false if this is not a normal pass though loop() at all, like the sleep and wake animations
+// that call the display vector over and over without updating now. Those need every frame.
+
+bool hostcore_deadlines();
+
+#endif /* HOSTCORE_H_ */
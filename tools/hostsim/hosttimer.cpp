@@ -0,0 +1,15 @@
+/*
+ * hosttimer.cpp
+ *
+ * Host builds use this in place of Timer.cpp. It is Timer.cpp exactly as is, except each time a Timer looks at
+ * millis() it also tells the simulated BIOS where it is, so fast forward will not jump past it when it expires.
+ *
+ */
+
+#include "blinklib.h"
+
+#include "hostbios.h"
+
+#define millis() hostbios_timer_millis( &m_expireTime )
+
+#include "Timer.cpp"
@@ -0,0 +1,72 @@
+#!/usr/bin/env python3
+"""
+ino2cpp.py - Turn a sketch into plain C++ the way the Arduino IDE does before compiling it.
+
+Adds the #include <Arduino.h> at the top, and a prototype for each top level function just before
+the first one, so the sketch can call functions that are defined further down.
+
+Usage: ino2cpp.py Sketch.ino out.cpp
+"""
+
+import re
+import sys
+
+# A function definition starts at column 0 with a return type, a name, and an argument list,
+# with the opening brace either on the same line or the next one.
+
+FUNCTION_RE = re.compile(r'^([A-Za-z_][\w:<>]*(?:\s+[\w:<>]+)*[\s\*&]+)([A-Za-z_]\w*)\s*\(([^;{}]*)\)\s*(\{.*)?$')
+
+NOT_TYPES = { 'if' , 'else' , 'for' , 'while' , 'switch' , 'return' , 'do' , 'case' , 'typedef' , 'struct' , 'enum' , 'union' , 'class' }
+
+
+def strip_comments(text):
+    # Blank out comments but keep the newlines so line numbers still match
+    def blank(m):
+        return re.sub(r'[^\n]', ' ', m.group(0))
+    return re.sub(r'//[^\n]*|/\*.*?\*/|"(?:\\.|[^"\\])*"|\'(?:\\.|[^\'\\])*\'',
+                  lambda m: blank(m) if m.group(0).startswith('/') else m.group(0), text, flags=re.S)
+
+
+def find_functions(lines):
+    """Returns (first line index, prototypes) for the top level function definitions."""
+    protos = []
+    first = None
+    depth = 0
+    for i, line in enumerate(lines):
+        if depth == 0:
+            m = FUNCTION_RE.match(line.rstrip())
+            if m and m.group(1).split()[0] not in NOT_TYPES:
+                opens = m.group(4) is not None or ( i + 1 < len(lines) and lines[i+1].strip().startswith('{') )
+                if opens:
+                    # Default arguments only go on the prototype, not both
+                    args = re.sub(r'\s*=\s*[^,]+', '', m.group(3))
+                    protos.append('%s%s(%s);' % (m.group(1), m.group(2), args))
+                    if first is None:
+                        first = i
+        depth += line.count('{') - line.count('}')
+    return first, protos
+
+
+def main():
+    src, dst = sys.argv[1], sys.argv[2]
+
+    with open(src) as f:
+        text = f.read()
+
+    lines = text.split('\n')
+    first, protos = find_functions(strip_comments(text).split('\n'))
+
+    out = [ '#include <Arduino.h>' , '#line 1 "%s"' % src ]
+
+    for i, line in enumerate(lines):
+        if i == first and protos:
+            out.extend(protos)
+            out.append('#line %d "%s"' % (i + 1, src))
+        out.append(line)
+
+    with open(dst, 'w') as f:
+        f.write('\n'.join(out))
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,157 @@
+/*
+ * soak.cpp
+ *
+ * Run a sketch for hours of tile time with fast forward, to see the slow things happen - warm sleep after
+ * WARM_SLEEP_TIMEOUT_MS of no button presses, the BIOS putting the tile into deep sleep, and waking back up.
+ *
+ * The tile is on its own the whole time. Prints a line for each time it goes to sleep or wakes, and a
+ * summary at the end. Same sketch and same arguments always print the same thing.
+ *
+ * Usage: soak [hours] [minutes between button presses]
+ *
+ * Default is 4 hours with no presses.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "hostbios.h"
+
+#include "shared/blinkbios_shared_button.h"
+
+#define SOAK_MAX_STEP_MS        1000        // Most we jump while the sketch is running, see hostbios_fast_forward()
+
+#define SOAK_IDLE_MS            1000        // This long without a pass though loop() and we call it warm sleep
+
+#define SOAK_CLICK_MS            100        // How long the button stays down
+
+static unsigned long soakEndTime;
+static unsigned long soakPressInterval;     // 0=never
+static unsigned long soakNextPress;
+static bool soakButtonDownFlag;
+
+static unsigned long soakPasses;
+static unsigned long soakLastPassTime;
+
+static bool soakIdleFlag;
+static bool soakAsleepFlag;
+
+static void soak_event( unsigned long now , const char *event ) {
+
+    printf( "{\"ms\": %lu, \"event\": \"%s\"}\n" , now , event );
+
+}
+
+void hostbios_time_hook( unsigned long now ) {
+
+    if ( now >= soakEndTime ) {
+
+        hostbios_stop();
+
+    }
+
+    if ( soakPressInterval ) {
+
+        if ( !soakButtonDownFlag && now >= soakNextPress ) {
+
+            hostbios_button_event( BUTTON_BITFLAG_PRESSED , 0 );
+            hostbios_button_down( 1 );
+
+            soakButtonDownFlag = true;
+
+            soak_event( now , "press" );
+
+        } else if ( soakButtonDownFlag && now >= soakNextPress + SOAK_CLICK_MS ) {
+
+            hostbios_button_event( BUTTON_BITFLAG_RELEASED | BUTTON_BITFLAG_SINGLECLICKED , 1 );
+            hostbios_button_down( 0 );
+
+            soakButtonDownFlag = false;
+
+            soakNextPress += soakPressInterval;
+
+        }
+
+    }
+
+    if ( hostbios_asleep() != soakAsleepFlag ) {
+
+        soakAsleepFlag = hostbios_asleep();
+
+        soak_event( now , soakAsleepFlag ? "deep sleep" : "woke from deep sleep" );
+
+    }
+
+    if ( !soakIdleFlag && !soakAsleepFlag && now - soakLastPassTime > SOAK_IDLE_MS ) {
+
+        soakIdleFlag = true;
+
+        soak_event( soakLastPassTime , "warm sleep" );
+
+    }
+
+    // Tell fast forward about the next thing we have scripted
+
+    hostbios_deadline( soakEndTime );
+
+    if ( soakPressInterval ) {
+
+        hostbios_deadline( soakButtonDownFlag ? soakNextPress + SOAK_CLICK_MS : soakNextPress );
+
+    }
+
+    if ( !soakIdleFlag ) {
+
+        hostbios_deadline( soakLastPassTime + SOAK_IDLE_MS + 1 );
+
+    }
+
+}
+
+void hostbios_pass_hook( unsigned long /*blocks*/ ) {
+
+    unsigned long now = hostbios_millis();
+
+    if ( soakIdleFlag ) {
+
+        soakIdleFlag = false;
+
+        soak_event( now , "running" );
+
+    }
+
+    soakPasses++;
+    soakLastPassTime = now;
+
+}
+
+int main( int argc , char **argv ) {
+
+    static const char * const exitNames[] = { "stopped" , "abend" , "seed" , "asleep" };
+
+    unsigned long hours = argc > 1 ? strtoul( argv[1] , NULL , 10 ) : 4;
+    unsigned long minutes = argc > 2 ? strtoul( argv[2] , NULL , 10 ) : 0;
+
+    soakEndTime = hours * 60 * 60 * 1000UL;
+    soakPressInterval = minutes * 60 * 1000UL;
+    soakNextPress = soakPressInterval;
+
+    hostbios_fast_forward( SOAK_MAX_STEP_MS );
+
+    clock_t start = clock();
+
+    uint8_t reason = hostbios_run();
+
+    printf( "{\"exit\": \"%s\", \"ms\": %lu, \"passes\": %lu, \"blocks\": %lu, \"host_ms\": %lu}\n" ,
+        exitNames[reason] ,
+        hostbios_millis() ,
+        soakPasses ,
+        hostbios_blocks() ,
+        (unsigned long) ( ( clock() - start ) * 1000 / CLOCKS_PER_SEC )
+    );
+
+    return reason == HOSTBIOS_EXIT_STOPPED ? 0 : 1;
+
+}
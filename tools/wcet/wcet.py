@@ -0,0 +1,663 @@
+#!/usr/bin/env python3
+"""
+wcet.py - Worst case cycles for each library function in a tile build. See README.md.
+
+Builds a sketch for a real tile, disassembles it, and works out the most cycles each function can
+take by following every path though it, with loops run as many times as they can and calls costing
+whatever the function they call can cost. Anything that can take longer than a frame (SHARED_FRAME_MS),
+or that we can not put a bound on at all, gets flagged.
+
+Usage:
+    wcet.py                     Analyze Examples01/A-BareMinimum, so everything in run() is library code
+    wcet.py Sketch.ino          Build this sketch with arduino-cli and analyze it
+    wcet.py Build.elf           Analyze something you already built
+    wcet.py --json ...          Print every function as JSON instead
+    wcet.py --self-test         Check the analysis against selftest.lst, which has hand counted answers
+
+Exits 1 if anything reachable from run() can go over the budget or has a loop we could not bound.
+"""
+
+import argparse
+import glob
+import json
+import os
+import re
+import shutil
+import subprocess
+import sys
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+REPO = os.path.normpath(os.path.join(HERE, '..', '..'))
+CORE = os.path.join(REPO, 'cores', 'blinklib')
+
+BOUNDS = os.path.join(HERE, 'bounds.txt')
+SELFTEST = os.path.join(HERE, 'selftest.lst')
+
+FQBN = 'move38:avr:blink'
+
+DEFAULT_SKETCH = os.path.join(REPO, 'libraries', 'Examples01', 'examples', 'A-BareMinimum', 'A-BareMinimum.ino')
+
+BIOS_BASE = 0x3800      # Start of the BlinkBIOS vector table, see linkscripts/avr5.xn
+
+# Cycles for each instruction on the ATmega168PB (AVRe+ core, 2 byte PC). Anything not listed is 1.
+# Branches and skips are counted as taken, and a skip as skipping a 2 word instruction.
+
+CYCLES = {}
+CYCLES.update( dict.fromkeys( 'adiw sbiw mul muls mulsu fmul fmuls fmulsu ld ldd lds st std sts push pop cbi sbi rjmp ijmp'.split() , 2 ) )
+CYCLES.update( dict.fromkeys( 'brbs brbc breq brne brcs brcc brsh brlo brmi brpl brge brlt brhs brhc brts brtc brvs brvc brie brid'.split() , 2 ) )
+CYCLES.update( dict.fromkeys( 'cpse sbrc sbrs sbic sbis'.split() , 3 ) )
+CYCLES.update( dict.fromkeys( 'lpm elpm jmp rcall icall'.split() , 3 ) )
+CYCLES.update( dict.fromkeys( 'call eicall ret reti spm'.split() , 4 ) )
+
+BRANCHES = { m for m in CYCLES if m.startswith('br') }
+SKIPS = { 'cpse' , 'sbrc' , 'sbrs' , 'sbic' , 'sbis' }
+JUMPS = { 'rjmp' , 'jmp' }
+CALLS = { 'rcall' , 'call' }
+RETURNS = { 'ret' , 'reti' }
+INDIRECT_JUMPS = { 'ijmp' , 'eijmp' }
+INDIRECT_CALLS = { 'icall' , 'eicall' }
+
+# libgcc helpers that end in an ijmp back to the caller instead of a ret
+
+RETURNING_IJMP = { '__prologue_saves__' , '__epilogue_restores__' }
+
+HEADER_RE = re.compile(r'^([0-9a-f]+) <(.+)>:$')
+INSN_RE = re.compile(r'^\s*([0-9a-f]+):\t((?:[0-9a-f]{2} )+)\s*(?:\t(\S+)\s*(.*))?$')
+LINE_RE = re.compile(r'^(.*\.(?:c|cpp|cc|h|hpp|S|ino)):(\d+)(?: \(discriminator \d+\))?$')
+
+COMMENT_TARGET_RE = re.compile(r';\s*0x([0-9a-f]+)')
+ABSOLUTE_RE = re.compile(r'0x([0-9a-f]+)')
+RELATIVE_RE = re.compile(r'\.([+-]\d+)')
+
+WCET_COMMENT_RE = re.compile(r'WCET:\s*(\d+)')
+FOR_UP_RE = re.compile(r'for\s*\([^;]*;\s*\w+\s*(<=|<|!=)\s*([^;]+);')
+FOR_DOWN_RE = re.compile(r'for\s*\([^;=]*=\s*([^;]+);\s*\w+\s*(>=|>)\s*0\s*;')
+
+
+def key(name):
+    # 'ServicePortSerial::write(unsigned char) [clone .lto_priv.0]' -> 'ServicePortSerial::write'
+    return name.split('(')[0].split(' ')[0]
+
+
+class Insn:
+
+    def __init__(self, addr, size, mnem, ops, line):
+        self.addr = addr
+        self.size = size
+        self.mnem = mnem
+        self.ops = ops
+        self.line = line
+        self.target = None
+
+        if mnem in BRANCHES or mnem in JUMPS or mnem in CALLS:
+            m = COMMENT_TARGET_RE.search(ops)
+            if m:
+                self.target = int(m.group(1), 16)
+            elif mnem in ( 'jmp' , 'call' ):
+                m = ABSOLUTE_RE.search(ops)
+                self.target = int(m.group(1), 16) if m else None
+            else:
+                m = RELATIVE_RE.search(ops)
+                self.target = addr + 2 + int(m.group(1)) if m else None
+
+    def cycles(self):
+        return CYCLES.get(self.mnem, 1)
+
+
+class Func:
+
+    def __init__(self, addr, name):
+        self.addr = addr
+        self.name = name
+        self.insns = []
+
+
+def disassemble(elf, objdump):
+    out = subprocess.run([ objdump , '-d' , '-l' , '-C' , elf ], stdout=subprocess.PIPE, universal_newlines=True, check=True)
+    return parse(out.stdout.splitlines())
+
+
+def parse(listing):
+    funcs = []
+    line = None
+
+    for text in listing:
+        m = HEADER_RE.match(text)
+        if m:
+            funcs.append(Func(int(m.group(1), 16), m.group(2)))
+            line = None
+            continue
+        m = LINE_RE.match(text)
+        if m:
+            line = ( m.group(1) , int(m.group(2)) )
+            continue
+        m = INSN_RE.match(text)
+        if m and funcs and m.group(3) and not m.group(3).startswith('.'):
+            funcs[-1].insns.append(Insn(int(m.group(1), 16), len(m.group(2).split()), m.group(3), m.group(4) or '', line))
+
+    return [ f for f in funcs if f.insns ]
+
+
+class Defines:
+    """Integer #defines from the core, so we can read loop bounds like `n < SLEEP_PACKET_REPEAT_COUNT`"""
+
+    DEFINE_RE = re.compile(r'^\s*#define\s+(\w+)\s+(.+)$')
+
+    def __init__(self):
+        self.raw = {}
+        for path in glob.glob(os.path.join(CORE, '*.h')) + glob.glob(os.path.join(CORE, '*.cpp')) + glob.glob(os.path.join(CORE, 'shared', '*.h')):
+            with open(path, errors='replace') as f:
+                for text in f:
+                    m = self.DEFINE_RE.match(text)
+                    if m:
+                        value = re.sub(r'/\*.*?\*/|//.*', '', m.group(2)).strip()
+                        if value:
+                            self.raw.setdefault(m.group(1), value)
+
+    def value(self, expr, depth=0):
+        if depth > 10:
+            return None
+        expr = re.sub(r'\b(0x[0-9a-fA-F]+|\d+)[uUlL]*\b', r'\1', expr.strip())
+        names = set(re.findall(r'\b[A-Za-z_]\w*\b', expr))
+        for name in names:
+            if name not in self.raw:
+                return None
+            v = self.value(self.raw[name], depth + 1)
+            if v is None:
+                return None
+            expr = re.sub(r'\b%s\b' % name, str(v), expr)
+        if not re.match(r'^[0-9a-fA-Fx()+\-*/%<> ]+$', expr):
+            return None
+        try:
+            return int(eval(expr.replace('/', '//'), { '__builtins__' : {} }))
+        except Exception:
+            return None
+
+
+class Sources:
+
+    def __init__(self):
+        self.files = {}
+
+    def text(self, line):
+        path, n = line
+        if path not in self.files:
+            self.files[path] = self.read(path)
+        lines = self.files[path]
+        return lines[n - 1] if lines and 0 < n <= len(lines) else ''
+
+    def read(self, path):
+        # The ELF has the paths from the machine that built it, which might not be this one
+        for p in [ path , os.path.join(CORE, os.path.basename(path)) ]:
+            if os.path.isfile(p):
+                with open(p, errors='replace') as f:
+                    return f.read().splitlines()
+        found = glob.glob(os.path.join(REPO, '**', os.path.basename(path)), recursive=True)
+        return self.read(found[0]) if found else None
+
+
+def read_bounds():
+    loops = {}
+    cycles = {}
+    if os.path.exists(BOUNDS):
+        with open(BOUNDS) as f:
+            for text in f:
+                words = text.split('#')[0].split()
+                if len(words) != 3:
+                    continue
+                kind, where, n = words
+                ( loops if kind == 'loop' else cycles )[where] = int(n)
+    return loops, cycles
+
+
+class Analysis:
+
+    def __init__(self, funcs, budget):
+        self.funcs = funcs
+        self.budget = budget
+        self.by_addr = {}
+        for f in funcs:
+            for i in f.insns:
+                self.by_addr[i.addr] = f
+        self.starts = { f.addr : f for f in funcs }
+        self.defines = Defines()
+        self.sources = Sources()
+        self.bound_loops, self.bound_cycles = read_bounds()
+        self.results = {}       # Func -> ( cycles , calls , flags , notes )
+        self.entries = {}       # ( Func , addr ) -> cycles, for jumps into the middle of a function
+        self.busy = set()
+
+    # --- Loop bounds
+
+    def loop_bound(self, func, lines):
+        for line in lines:
+            where = '%s:%d' % ( os.path.basename(line[0]) , line[1] )
+            if where in self.bound_loops:
+                return self.bound_loops[where]
+        for line in lines:
+            text = self.sources.text(line)
+            m = WCET_COMMENT_RE.search(text)
+            if m:
+                return int(m.group(1))
+        for line in lines:
+            text = self.sources.text(line)
+            if 'FOREACH_FACE(' in text:
+                return self.defines.value('FACE_COUNT')
+            m = FOR_UP_RE.search(text)
+            if m:
+                v = self.defines.value(m.group(2))
+                if v is not None:
+                    return v + 1 if m.group(1) == '<=' else v
+            m = FOR_DOWN_RE.search(text)
+            if m:
+                v = self.defines.value(m.group(1))
+                if v is not None:
+                    return v + 1 if m.group(2) == '>=' else v
+        return self.bound_loops.get(key(func.name))
+
+    def loop_location(self, lines):
+        for line in lines:
+            if re.search(r'\b(for|while|do)\b|FOREACH_FACE', self.sources.text(line)):
+                return '%s:%d' % ( os.path.basename(line[0]) , line[1] )
+        for line in lines:
+            return '%s:%d' % ( os.path.basename(line[0]) , line[1] )
+        return '?'
+
+    # --- Calls
+
+    def call(self, insn, flags, notes):
+        """Cycles for a call (or tail jump) to insn.target, not counting the call instruction itself"""
+        target = insn.target
+        callee = self.by_addr.get(target) if target is not None else None
+
+        if callee is None:
+            name = re.search(r'<(.+)>', insn.ops)
+            name = name.group(1) if name else ( '0x%x' % target if target is not None else '?' )
+            if key(name) in self.bound_cycles:
+                return name, self.bound_cycles[key(name)]
+            if name.startswith('boot_vector') or ( target is not None and target >= BIOS_BASE ):
+                notes.add('calls BIOS %s (not counted)' % name)
+            else:
+                flags.add('call to unknown %s' % name)
+            return name, 0
+
+        if key(callee.name) in self.bound_cycles:
+            return callee.name, self.bound_cycles[key(callee.name)]
+
+        if target == callee.addr:
+            cycles, _, callee_flags, callee_notes = self.analyze(callee)
+        else:
+            cycles, callee_flags, callee_notes = self.analyze_entry(callee, target)
+
+        flags.update(callee_flags)
+        notes.update(callee_notes)
+        return callee.name, cycles
+
+    # --- One function
+
+    def analyze(self, func):
+        if func in self.results:
+            return self.results[func]
+        if func in self.busy:
+            return 0, {}, { 'recursion in %s' % func.name }, set()
+        self.busy.add(func)
+        result = self.walk(func, func.insns[0].addr)
+        self.busy.discard(func)
+        self.results[func] = result
+        return result
+
+    def analyze_entry(self, func, addr):
+        # Start from the instruction the jump lands on
+        addr = max( i.addr for i in func.insns if i.addr <= addr )
+        if ( func , addr ) not in self.entries:
+            if func in self.busy:
+                return 0, { 'recursion in %s' % func.name }, set()
+            self.busy.add(func)
+            cycles, _, flags, notes = self.walk(func, addr)
+            self.busy.discard(func)
+            self.entries[ ( func , addr ) ] = ( cycles , flags , notes )
+        return self.entries[ ( func , addr ) ]
+
+    def walk(self, func, entry):
+        insns = func.insns
+        index = { i.addr : n for n, i in enumerate(insns) }
+        flags = set()
+        notes = set()
+
+        sys.setrecursionlimit(max(sys.getrecursionlimit(), 10 * len(insns) + 1000))
+
+        # Split into basic blocks
+
+        leaders = { insns[0].addr , entry }
+        for n, i in enumerate(insns):
+            ends = i.mnem in BRANCHES or i.mnem in SKIPS or i.mnem in JUMPS or i.mnem in RETURNS or i.mnem in INDIRECT_JUMPS
+            if ends and n + 1 < len(insns):
+                leaders.add(insns[n + 1].addr)
+            if i.mnem in SKIPS and n + 2 < len(insns):
+                leaders.add(insns[n + 2].addr)
+            if ( i.mnem in BRANCHES or i.mnem in JUMPS ) and i.target in index:
+                leaders.add(i.target)
+
+        blocks = {}         # leader -> list of insns
+        order = []
+        for i in insns:
+            if i.addr in leaders:
+                order.append(i.addr)
+                blocks[i.addr] = []
+            blocks[order[-1]].append(i)
+
+        cost = {}
+        calls = {}
+        succ = {}
+
+        for b in order:
+            c = 0
+            called = {}
+            for i in blocks[b]:
+                c += i.cycles()
+                if i.mnem in CALLS:
+                    name, cycles = self.call(i, flags, notes)
+                    c += cycles
+                    called[name] = called.get(name, 0) + cycles
+                elif i.mnem in INDIRECT_CALLS:
+                    flags.add('indirect call in %s' % func.name)
+
+            last = blocks[b][-1]
+            n = index[last.addr]
+            following = [ insns[n + 1].addr ] if n + 1 < len(insns) else []
+
+            if last.mnem in RETURNS:
+                s = []
+            elif last.mnem in INDIRECT_JUMPS:
+                if key(func.name) not in RETURNING_IJMP:
+                    flags.add('indirect jump in %s' % func.name)
+                s = []
+            elif last.mnem in JUMPS:
+                if last.target in index:
+                    s = [ last.target ]
+                else:
+                    # Tail call
+                    name, cycles = self.call(last, flags, notes)
+                    c += cycles
+                    called[name] = called.get(name, 0) + cycles
+                    s = []
+            elif last.mnem in BRANCHES:
+                s = following + ( [ last.target ] if last.target in index else [] )
+            elif last.mnem in SKIPS:
+                s = following + ( [ insns[n + 2].addr ] if n + 2 < len(insns) else [] )
+            else:
+                s = following
+
+            cost[b] = c
+            calls[b] = called
+            succ[b] = s
+
+        # Find the loops. Edges back to a block still on the depth first stack close a loop.
+
+        back = set()
+        state = {}
+        for root in [ entry ] + order:
+            if root in state:
+                continue
+            stack = [ ( root , iter(succ[root]) ) ]
+            state[root] = 1
+            while stack:
+                b, it = stack[-1]
+                for s in it:
+                    if state.get(s) == 1:
+                        back.add( ( b , s ) )
+                    elif s not in state:
+                        state[s] = 1
+                        stack.append( ( s , iter(succ[s]) ) )
+                        break
+                else:
+                    state[b] = 2
+                    stack.pop()
+
+        dag = { b : [ s for s in succ[b] if ( b , s ) not in back ] for b in order }
+
+        pred = { b : [] for b in order }
+        for b in order:
+            for s in dag[b]:
+                pred[s].append(b)
+
+        loops = {}
+        for b, h in back:
+            loops.setdefault(h, set()).add(b)
+
+        bodies = {}
+        for h, latches in loops.items():
+            body = { h }
+            todo = [ l for l in latches if l != h ]
+            while todo:
+                b = todo.pop()
+                if b not in body:
+                    body.add(b)
+                    todo.extend(pred[b])
+            bodies[h] = body
+
+        # Innermost loops first. Each loop header gets charged for all but the last time around,
+        # the last one is covered by the path that leaves the loop.
+
+        for h in sorted(loops, key=lambda h: len(bodies[h])):
+            body = bodies[h]
+            latches = loops[h]
+
+            memo = {}
+
+            def around(b):
+                if b not in memo:
+                    best = ( 0 , {} ) if b in latches else None
+                    for s in dag[b]:
+                        if s in body:
+                            r = around(s)
+                            if best is None or r[0] > best[0]:
+                                best = r
+                    if best is None:
+                        best = ( 0 , {} )
+                    memo[b] = ( cost[b] + best[0] , add(calls[b], best[1]) )
+                return memo[b]
+
+            once, once_calls = around(h)
+
+            exits = any( s not in body for b in body for s in succ[b] ) or any( not succ[b] for b in body )
+
+            if not exits:
+                # Goes around forever, like the main loop in run(). Report one pass.
+                notes.add('%s is per pass' % func.name)
+                continue
+
+            lines = [ i.line for b in [ h ] + sorted(latches) for i in blocks[b] if i.line ]
+            bound = self.loop_bound(func, lines)
+
+            if bound is None:
+                flags.add('unbounded loop at %s' % self.loop_location(lines))
+                continue
+
+            cost[h] += bound * once
+            calls[h] = add(calls[h], { k : v * bound for k, v in once_calls.items() })
+
+        # Longest path though the whole thing
+
+        memo = {}
+
+        def longest(b):
+            if b not in memo:
+                best = ( 0 , {} )
+                for s in dag[b]:
+                    r = longest(s)
+                    if r[0] > best[0]:
+                        best = r
+                memo[b] = ( cost[b] + best[0] , add(calls[b], best[1]) )
+            return memo[b]
+
+        cycles, worst_calls = longest(entry)
+
+        return cycles, worst_calls, flags, notes
+
+    # --- Everything reachable from the root
+
+    def reachable(self, root):
+        seen = []
+        todo = [ root ]
+        while todo:
+            f = todo.pop()
+            if f in seen:
+                continue
+            seen.append(f)
+            for i in f.insns:
+                if ( i.mnem in CALLS or i.mnem in JUMPS ) and i.target in self.by_addr:
+                    g = self.by_addr[i.target]
+                    if g is not f and key(g.name) not in self.bound_cycles:
+                        todo.append(g)
+        return seen
+
+
+def add(a, b):
+    if not b:
+        return a
+    r = dict(a)
+    for k, v in b.items():
+        r[k] = r.get(k, 0) + v
+    return r
+
+
+def find_objdump(path):
+    if path:
+        return path
+    if os.environ.get('AVR_OBJDUMP'):
+        return os.environ['AVR_OBJDUMP']
+    if shutil.which('avr-objdump'):
+        return 'avr-objdump'
+    # The toolchain that arduino-cli or the IDE installed
+    homes = [ os.path.expanduser('~/.arduino15') , os.path.expanduser('~/Library/Arduino15') , os.path.join(os.environ.get('LOCALAPPDATA', ''), 'Arduino15') ]
+    for home in homes:
+        found = sorted(glob.glob(os.path.join(home, 'packages', '*', 'tools', 'avr-gcc', '*', 'bin', 'avr-objdump*')))
+        if found:
+            return found[-1]
+    sys.exit('Could not find avr-objdump. Put it on the path or use --objdump.')
+
+
+def build(sketch):
+    if not shutil.which('arduino-cli'):
+        sys.exit('Need arduino-cli with the Blinks board package (%s) to build %s. Or pass an .elf.' % ( FQBN , sketch ))
+    name = os.path.basename(sketch)
+    path = os.path.join(HERE, 'build', os.path.splitext(name)[0])
+    subprocess.run([ 'arduino-cli' , 'compile' , '--fqbn' , FQBN , '--build-path' , path , os.path.dirname(os.path.abspath(sketch)) ], check=True)
+    return os.path.join(path, name + '.elf')
+
+
+# What selftest.lst should come out to, counted by hand from the datasheet cycles. run() calls leaf() (11),
+# __udivmodqi4 (41, its loop bound of 8 is from bounds.txt), and the BIOS, then jumps back to the top.
+
+SELFTEST_EXPECT = [
+    ( 'leaf' , 11 , [] , [] ),
+    ( '__udivmodqi4' , 41 , [] , [] ),
+    ( 'spin' , None , [ 'unbounded loop at ?' ] , [] ),
+    ( 'run' , 4 + 11 + 4 + 41 + 4 + 2 , [] , [ 'calls BIOS boot_vector4 (not counted)' , 'run is per pass' ] ),
+]
+
+
+def self_test():
+    with open(SELFTEST) as f:
+        funcs = parse(f.read().splitlines())
+
+    analysis = Analysis(funcs, 0)
+    by_name = { f.name : f for f in funcs }
+    failed = False
+
+    for name, cycles, flags, notes in SELFTEST_EXPECT:
+        if name not in by_name:
+            print('%s: missing from %s' % ( name , SELFTEST ))
+            failed = True
+            continue
+        got_cycles, _, got_flags, got_notes = analysis.analyze(by_name[name])
+        if ( cycles is not None and got_cycles != cycles ) or sorted(got_flags) != flags or sorted(got_notes) != notes:
+            print('%s: got %d cycles, flags %s, notes %s' % ( name , got_cycles , sorted(got_flags) , sorted(got_notes) ))
+            print('%s: expected %s cycles, flags %s, notes %s' % ( name , cycles , flags , notes ))
+            failed = True
+
+    print('Self test %s' % ( 'FAILED' if failed else 'passed' ))
+    return 1 if failed else 0
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Worst case cycles for each library function in a tile build')
+    parser.add_argument('target', nargs='?', default=DEFAULT_SKETCH, help='sketch (.ino) or built .elf (default Examples01/A-BareMinimum)')
+    parser.add_argument('--root', default='run', help='function to start from (default run)')
+    parser.add_argument('--budget-ms', type=float, help='flag anything that can take longer than this (default SHARED_FRAME_MS)')
+    parser.add_argument('--objdump', help='avr-objdump to use')
+    parser.add_argument('--json', action='store_true', help='print every function as JSON')
+    parser.add_argument('--self-test', action='store_true', help='check the analysis against selftest.lst and exit')
+    args = parser.parse_args()
+
+    if args.self_test:
+        return self_test()
+
+    elf = args.target if args.target.endswith('.elf') else build(args.target)
+
+    defines = Defines()
+    f_cpu = 8000000
+    with open(os.path.join(REPO, 'boards.txt')) as f:
+        m = re.search(r'^blink\.build\.f_cpu=(\d+)', f.read(), re.M)
+        if m:
+            f_cpu = int(m.group(1))
+    budget_ms = args.budget_ms if args.budget_ms is not None else defines.value('SHARED_FRAME_MS')
+    budget = int(f_cpu * budget_ms / 1000)
+
+    funcs = disassemble(elf, find_objdump(args.objdump))
+    analysis = Analysis(funcs, budget)
+
+    roots = [ f for f in funcs if key(f.name) == args.root ]
+    if not roots:
+        sys.exit('No function called %s in %s' % ( args.root , elf ))
+
+    reachable = []
+    for root in roots:
+        reachable += [ f for f in analysis.reachable(root) if f not in reachable ]
+
+    rows = []
+    for f in reachable:
+        cycles, calls, flags, notes = analysis.analyze(f)
+        problems = sorted(flags)
+        if cycles > budget:
+            problems.insert(0, 'over budget')
+        rows.append({ 'function' : f.name , 'cycles' : cycles , 'ms' : round(cycles * 1000.0 / f_cpu, 3) ,
+                      'flags' : problems , 'notes' : sorted(notes) , 'worst_calls' : calls })
+
+    rows.sort(key=lambda r: -r['cycles'])
+
+    failed = any(r['flags'] for r in rows)
+
+    if args.json:
+        print(json.dumps({ 'elf' : elf , 'f_cpu' : f_cpu , 'budget_cycles' : budget , 'functions' : rows }, indent=2))
+        return 1 if failed else 0
+
+    print('Budget is %d cycles (%g ms at %d Hz)' % ( budget , budget_ms , f_cpu ))
+    print()
+    print('%-40s %10s %9s %7s' % ( 'function' , 'cycles' , 'ms' , 'budget' ))
+
+    for r in rows:
+        print('%-40s %10d %9.3f %6.1f%%' % ( r['function'][:40] , r['cycles'] , r['ms'] , 100.0 * r['cycles'] / budget ))
+        for flag in r['flags']:
+            print('    ' + flag)
+
+    for root in roots:
+        cycles, calls, flags, notes = analysis.analyze(root)
+        print()
+        print('Worst path though %s, %d cycles:' % ( root.name , cycles ))
+        for name, c in sorted(calls.items(), key=lambda kv: -kv[1])[:10]:
+            print('    %-36s %10d' % ( name[:36] , c ))
+        print('    %-36s %10d' % ( '(its own code)' , cycles - sum(calls.values()) ))
+        for note in sorted(notes):
+            print('    ' + note)
+
+    if failed:
+        print()
+        print('Some paths can take longer than a frame, or have loops with no bound. See README.md for adding bounds.')
+
+    return 1 if failed else 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())